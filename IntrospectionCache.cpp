@@ -0,0 +1,92 @@
+#include "IntrospectionCache.h"
+
+#include "ResponseCache.h"
+
+#include "graphqlservice/JSONResponse.h"
+
+#include <sstream>
+
+using namespace graphql;
+
+std::string IntrospectionCache::MakeKey(const schema::Schema& schema,
+	const QueryRegistry::Entry& query, std::string_view operationName,
+	const response::Value& variables)
+{
+	std::ostringstream key;
+
+	key << static_cast<const void*>(&schema) << '\n'
+		<< query.normalized << '\n'
+		<< operationName << '\n'
+		<< ResponseCache::CanonicalJSON(variables);
+
+	return key.str();
+}
+
+std::shared_ptr<const IntrospectionCache::Result> IntrospectionCache::Find(
+	const std::string& key)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto itr = _results.find(key);
+
+	if (itr == _results.end())
+	{
+		++_stats.misses;
+		return nullptr;
+	}
+
+	++_stats.hits;
+
+	return itr->second;
+}
+
+std::shared_ptr<const IntrospectionCache::Result> IntrospectionCache::Insert(
+	std::string key, response::Value&& document)
+{
+	const auto errors = document.find(service::strErrors);
+	const bool cacheable =
+		errors == document.end() || errors->second.type() == response::Type::Null;
+	auto json = response::toJSON(response::Value { document });
+	auto result = std::make_shared<const Result>(Result { std::move(document), std::move(json) });
+
+	if (!cacheable)
+	{
+		return result;
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto [itr, inserted] = _results.emplace(key, result);
+
+	if (!inserted)
+	{
+		// Another thread resolved the same query in the meantime.
+		return itr->second;
+	}
+
+	_order.push_back(std::move(key));
+
+	if (_order.size() > MaxEntries)
+	{
+		_results.erase(_order.front());
+		_order.pop_front();
+	}
+
+	return result;
+}
+
+void IntrospectionCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_results.clear();
+	_order.clear();
+}
+
+IntrospectionCache::Stats IntrospectionCache::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto stats = _stats;
+
+	stats.entries = _results.size();
+
+	return stats;
+}
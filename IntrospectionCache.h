@@ -0,0 +1,68 @@
+#pragma once
+
+#ifndef INTROSPECTIONCACHE_H
+#define INTROSPECTIONCACHE_H
+
+#include "QueryRegistry.h"
+
+#include "graphqlservice/GraphQLService.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Results of introspection-only queries (see QueryRegistry::Entry::Operation::introspection). The
+// schema never changes after startService, so tools like GraphiQL which send the same full
+// introspection query every time a window opens can get the previous result back without
+// resolving hundreds of __Type and __Field objects again. Each result keeps both the document and
+// its JSON, so a hit skips toJSON as well for string and external output.
+//
+// All of the methods are safe to call from any thread.
+class IntrospectionCache
+{
+public:
+	struct Result
+	{
+		graphql::response::Value document;
+		std::string json;
+	};
+
+	struct Stats
+	{
+		std::uint64_t hits = 0;
+		std::uint64_t misses = 0;
+		size_t entries = 0;
+	};
+
+	// Number of distinct results to keep, the oldest one is evicted after that.
+	static constexpr size_t MaxEntries = 64;
+
+	// The schema identity, the normalized document, the operation name and the variables in the same
+	// canonical form the ResponseCache uses.
+	static std::string MakeKey(const graphql::schema::Schema& schema,
+		const QueryRegistry::Entry& query, std::string_view operationName,
+		const graphql::response::Value& variables);
+
+	std::shared_ptr<const Result> Find(const std::string& key);
+
+	// Serializes the document and keeps it unless it has errors. Returns the result either way,
+	// so the caller can deliver the same JSON.
+	std::shared_ptr<const Result> Insert(std::string key, graphql::response::Value&& document);
+
+	void Clear();
+
+	Stats GetStats() const;
+
+private:
+	mutable std::mutex _mutex;
+	std::unordered_map<std::string, std::shared_ptr<const Result>> _results;
+	std::deque<std::string> _order;
+	Stats _stats;
+};
+
+#endif // INTROSPECTIONCACHE_H
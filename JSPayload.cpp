@@ -0,0 +1,543 @@
+#include "JSPayload.h"
+
+#include "graphqlservice/internal/Base64.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+using namespace graphql;
+
+namespace {
+
+// Names which show up in responses without being declared as fields in the schema.
+constexpr std::array<std::string_view, 10> s_responseNames = {
+	"data",
+	"errors",
+	"hasNext",
+	"incremental",
+	"message",
+	"locations",
+	"line",
+	"column",
+	"path",
+	"extensions",
+};
+
+class ExternalPayload : public v8::String::ExternalOneByteStringResource
+{
+public:
+	explicit ExternalPayload(std::string&& payload)
+		: _payload(std::move(payload))
+	{
+	}
+
+	const char* data() const override
+	{
+		return _payload.data();
+	}
+
+	size_t length() const override
+	{
+		return _payload.size();
+	}
+
+private:
+	std::string _payload;
+};
+
+// Set by detectExternalBuffers. It's the same for every environment in the process, and it starts
+// out false, so a payload never ends up in external memory before we know that's safe.
+std::atomic<bool> s_externalBuffers { false };
+
+bool isAscii(const std::string& payload) noexcept
+{
+	return std::all_of(payload.cbegin(), payload.cend(), [](char ch) noexcept {
+		return (static_cast<unsigned char>(ch) & 0x80) == 0;
+	});
+}
+
+v8::Local<v8::Value> makeExternalBuffer(std::string&& payload)
+{
+	if (!s_externalBuffers.load(std::memory_order_relaxed))
+	{
+		// External backing stores aren't allowed inside the V8 sandbox, so this is the one case
+		// where we still need to copy the payload.
+		return Nan::CopyBuffer(payload.data(), static_cast<uint32_t>(payload.size()))
+			.ToLocalChecked();
+	}
+
+	auto buffer = std::make_unique<std::string>(std::move(payload));
+	auto data = buffer->data();
+	const auto size = buffer->size();
+	auto result = Nan::NewBuffer(
+		data,
+		size,
+		[](char*, void* hint) {
+			delete static_cast<std::string*>(hint);
+		},
+		buffer.get())
+					  .ToLocalChecked();
+
+	// The finalizer owns it now.
+	buffer.release();
+
+	return result;
+}
+
+v8::Local<v8::Value> makeJSString(std::string_view text)
+{
+	return Nan::New<v8::String>(text.data(), static_cast<int>(text.size())).ToLocalChecked();
+}
+
+v8::Local<v8::Value> makeJSValue(const response::Value& value, const FieldNameCache& names)
+{
+	switch (value.type())
+	{
+		case response::Type::Map:
+		{
+			Nan::EscapableHandleScope scope;
+			const auto& members = value.get<response::MapType>();
+			auto result = Nan::New<v8::Object>();
+
+			for (const auto& member : members)
+			{
+				Nan::Set(result, names.Lookup(member.first), makeJSValue(member.second, names));
+			}
+
+			return scope.Escape(result);
+		}
+
+		case response::Type::List:
+		{
+			Nan::EscapableHandleScope scope;
+			const auto& elements = value.get<response::ListType>();
+			auto result = Nan::New<v8::Array>(static_cast<int>(elements.size()));
+
+			for (size_t i = 0; i < elements.size(); ++i)
+			{
+				Nan::Set(result, static_cast<uint32_t>(i), makeJSValue(elements[i], names));
+			}
+
+			return scope.Escape(result);
+		}
+
+		case response::Type::String:
+		case response::Type::EnumValue:
+			return makeJSString(value.get<response::StringType>());
+
+		case response::Type::Null:
+			return Nan::Null();
+
+		case response::Type::Boolean:
+			return Nan::New(value.get<response::BooleanType>());
+
+		case response::Type::Int:
+			return Nan::New<v8::Int32>(value.get<response::IntType>());
+
+		case response::Type::Float:
+			return Nan::New<v8::Number>(value.get<response::FloatType>());
+
+		case response::Type::ID:
+		{
+			// Match the JSON serialization of an ID.
+			const auto& id = value.get<response::IdType>();
+
+			return id.isBase64()
+				? makeJSString(internal::Base64::toBase64(id.get<response::IdType::ByteData>()))
+				: makeJSString(id.get<response::IdType::OpaqueString>());
+		}
+
+		case response::Type::Scalar:
+			return makeJSValue(value.get<response::ScalarType>(), names);
+	}
+
+	return Nan::Undefined();
+}
+
+} // namespace
+
+FieldNameCache::FieldNameCache(std::shared_ptr<const schema::Schema> schema)
+	: _schema(std::move(schema))
+{
+	for (const auto& name : s_responseNames)
+	{
+		Add(name);
+	}
+
+	for (const auto& entry : _schema->types())
+	{
+		for (const auto& field : entry.second->fields())
+		{
+			Add(field->name());
+		}
+	}
+}
+
+void FieldNameCache::Add(std::string_view name)
+{
+	if (_names.find(name) != _names.end())
+	{
+		return;
+	}
+
+	auto internalized = v8::String::NewFromUtf8(v8::Isolate::GetCurrent(),
+		name.data(),
+		v8::NewStringType::kInternalized,
+		static_cast<int>(name.size()))
+							.ToLocalChecked();
+
+	_names.emplace(name, Nan::Global<v8::String>(internalized));
+}
+
+v8::Local<v8::String> FieldNameCache::Lookup(std::string_view name) const
+{
+	const auto itr = _names.find(name);
+
+	if (itr != _names.end())
+	{
+		return Nan::New(itr->second);
+	}
+
+	// Aliases aren't part of the schema, and there's no limit to how many of them there might be.
+	return Nan::New<v8::String>(name.data(), static_cast<int>(name.size())).ToLocalChecked();
+}
+
+// Electron enables the V8 sandbox (since Electron 21), which aborts the process if it sees a Buffer
+// over external memory, and it doesn't say so in a way we can check at compile time. So look for
+// process.versions.electron instead, which is there in the main process, the renderers, workers,
+// and with ELECTRON_RUN_AS_NODE.
+void detectExternalBuffers()
+{
+	Nan::HandleScope scope;
+	const auto getMember = [](v8::Local<v8::Value> object, const char* name) {
+		return object->IsObject()
+			? Nan::Get(object.As<v8::Object>(), Nan::New<v8::String>(name).ToLocalChecked())
+				  .FromMaybe(v8::Local<v8::Value>(Nan::Undefined()))
+			: v8::Local<v8::Value>(Nan::Undefined());
+	};
+	const auto electron = getMember(
+		getMember(getMember(Nan::GetCurrentContext()->Global(), "process"), "versions"),
+		"electron");
+
+	s_externalBuffers.store(electron->IsUndefined(), std::memory_order_relaxed);
+}
+
+v8::Local<v8::Value> makeJSPayload(
+	PayloadChannel::Payload&& payload, PayloadOutput output, const FieldNameCache& names)
+{
+	if (const auto document = std::get_if<response::Value>(&payload))
+	{
+		return makeJSValue(*document, names);
+	}
+
+	auto& json = std::get<std::string>(payload);
+
+	switch (output)
+	{
+		case PayloadOutput::External:
+		{
+			if (!isAscii(json))
+			{
+				return makeExternalBuffer(std::move(json));
+			}
+
+			// V8 takes ownership of the resource and calls Dispose (which deletes it) when the
+			// string is collected.
+			auto resource = std::make_unique<ExternalPayload>(std::move(json));
+			auto result = Nan::New<v8::String>(resource.get()).ToLocalChecked();
+
+			resource.release();
+
+			return result;
+		}
+
+		case PayloadOutput::String:
+		default:
+			return makeJSString(json);
+	}
+}
+
+namespace {
+
+// Deep enough for any variables a client would reasonably send, and shallow enough that the
+// recursion can't run out of native stack.
+constexpr size_t s_maxVariableDepth = 256;
+
+// The objects and arrays between the root and the value being converted, to catch cycles which
+// JSON.stringify would have rejected.
+using Ancestors = std::vector<v8::Local<v8::Object>>;
+
+// The array indices and object keys which lead from the root to the value being converted. It's
+// only formatted if the conversion fails.
+using Path = std::vector<std::variant<uint32_t, v8::Local<v8::Value>>>;
+
+std::string formatPath(const Path& path)
+{
+	std::string result { "variables" };
+
+	for (const auto& segment : path)
+	{
+		if (std::holds_alternative<uint32_t>(segment))
+		{
+			result += "[" + std::to_string(std::get<uint32_t>(segment)) + "]";
+		}
+		else
+		{
+			result += ".";
+			result += *Nan::Utf8String(std::get<v8::Local<v8::Value>>(segment));
+		}
+	}
+
+	return result;
+}
+
+// A getter, a Proxy trap or toJSON threw while converting the value at the path, so the call fails
+// the way JSON.stringify would, instead of aborting on an empty handle.
+[[noreturn]] void throwConversionError(
+	std::string_view what, const Path& path, const Nan::TryCatch& tryCatch)
+{
+	auto message = std::string { "Variable " } + std::string { what } + " at " + formatPath(path);
+
+	if (tryCatch.HasCaught())
+	{
+		message += " threw: ";
+		message += *Nan::Utf8String(tryCatch.Exception());
+	}
+	else
+	{
+		message += " failed";
+	}
+
+	throw std::invalid_argument(message);
+}
+
+// Pushes an array index or an object key onto the path while its value is being converted.
+class PathScope
+{
+public:
+	template <class Segment>
+	explicit PathScope(Path& path, Segment segment)
+		: _path { path }
+	{
+		_path.emplace_back(segment);
+	}
+
+	~PathScope()
+	{
+		_path.pop_back();
+	}
+
+private:
+	Path& _path;
+};
+
+response::Value makeResponseValue(v8::Local<v8::Value> value, Ancestors& ancestors, Path& path);
+
+// Like JSON.stringify, let an object with a toJSON method (e.g. a Date) replace itself.
+v8::Local<v8::Value> callToJSON(v8::Local<v8::Object> object, const Path& path)
+{
+	Nan::TryCatch tryCatch;
+	auto toJSON = Nan::Get(object, Nan::New<v8::String>("toJSON").ToLocalChecked());
+
+	if (toJSON.IsEmpty())
+	{
+		throwConversionError("toJSON", path, tryCatch);
+	}
+
+	if (!toJSON.ToLocalChecked()->IsFunction())
+	{
+		return object;
+	}
+
+	v8::Local<v8::Value> argv[] = { Nan::EmptyString() };
+	auto result = Nan::Call(toJSON.ToLocalChecked().As<v8::Function>(), object, 1, argv);
+
+	if (result.IsEmpty())
+	{
+		throwConversionError("toJSON", path, tryCatch);
+	}
+
+	return result.ToLocalChecked();
+}
+
+// Pushes the object onto the ancestors while it's being converted.
+class AncestorScope
+{
+public:
+	explicit AncestorScope(Ancestors& ancestors, v8::Local<v8::Object> object)
+		: _ancestors { ancestors }
+	{
+		if (_ancestors.size() >= s_maxVariableDepth)
+		{
+			throw std::invalid_argument("Variables are nested too deeply");
+		}
+
+		if (std::any_of(_ancestors.cbegin(),
+				_ancestors.cend(),
+				[object](v8::Local<v8::Object> ancestor) {
+					return ancestor->StrictEquals(object);
+				}))
+		{
+			throw std::invalid_argument("Variables contain a cycle");
+		}
+
+		_ancestors.push_back(object);
+	}
+
+	~AncestorScope()
+	{
+		_ancestors.pop_back();
+	}
+
+private:
+	Ancestors& _ancestors;
+};
+
+response::Value makeResponseValue(v8::Local<v8::Value> value, Ancestors& ancestors, Path& path)
+{
+	if (value->IsObject() && !value->IsArrayBufferView() && !value->IsFunction())
+	{
+		value = callToJSON(value.As<v8::Object>(), path);
+	}
+
+	if (value->IsNull() || value->IsUndefined())
+	{
+		return response::Value {};
+	}
+
+	if (value->IsBoolean())
+	{
+		return response::Value { Nan::To<bool>(value).FromJust() };
+	}
+
+	if (value->IsInt32())
+	{
+		return response::Value { static_cast<response::IntType>(
+			Nan::To<std::int32_t>(value).FromJust()) };
+	}
+
+	if (value->IsNumber())
+	{
+		const auto number = Nan::To<double>(value).FromJust();
+
+		// JSON.stringify writes NaN and Infinity as null, and the JSON writer can't represent them.
+		if (!std::isfinite(number))
+		{
+			return response::Value {};
+		}
+
+		return response::Value { static_cast<response::FloatType>(number) };
+	}
+
+	if (value->IsString())
+	{
+		// ID arguments still accept base64 strings, and the service decodes them while it converts
+		// the arguments, exactly as it would if they came from parseJSON.
+		return response::Value { std::string { *Nan::Utf8String(value) } };
+	}
+
+	if (value->IsArrayBufferView())
+	{
+		// Binary IDs can skip base64 entirely.
+		auto view = value.As<v8::ArrayBufferView>();
+		response::IdType::ByteData bytes(view->ByteLength());
+
+		view->CopyContents(bytes.data(), bytes.size());
+
+		return response::Value { response::IdType { std::move(bytes) } };
+	}
+
+	if (value->IsArray())
+	{
+		Nan::HandleScope scope;
+		auto elements = value.As<v8::Array>();
+		AncestorScope ancestor { ancestors, elements };
+		const auto length = elements->Length();
+		response::Value result { response::Type::List };
+
+		result.reserve(length);
+
+		for (uint32_t i = 0; i < length; ++i)
+		{
+			PathScope segment { path, i };
+			Nan::TryCatch tryCatch;
+			auto element = Nan::Get(elements, i);
+
+			if (element.IsEmpty())
+			{
+				throwConversionError("getter", path, tryCatch);
+			}
+
+			result.emplace_back(makeResponseValue(element.ToLocalChecked(), ancestors, path));
+		}
+
+		return result;
+	}
+
+	if (value->IsObject() && !value->IsFunction())
+	{
+		Nan::HandleScope scope;
+		auto object = value.As<v8::Object>();
+		AncestorScope ancestor { ancestors, object };
+		Nan::TryCatch tryCatch;
+		auto ownKeys = Nan::GetOwnPropertyNames(object);
+
+		if (ownKeys.IsEmpty())
+		{
+			throwConversionError("ownKeys", path, tryCatch);
+		}
+
+		auto keys = ownKeys.ToLocalChecked();
+		const auto length = keys->Length();
+		response::Value result { response::Type::Map };
+
+		result.reserve(length);
+
+		for (uint32_t i = 0; i < length; ++i)
+		{
+			auto key = Nan::Get(keys, i);
+
+			if (key.IsEmpty())
+			{
+				throwConversionError("ownKeys", path, tryCatch);
+			}
+
+			PathScope segment { path, key.ToLocalChecked() };
+			auto member = Nan::Get(object, key.ToLocalChecked());
+
+			if (member.IsEmpty())
+			{
+				throwConversionError("getter", path, tryCatch);
+			}
+
+			// Match JSON.stringify, which leaves out undefined members.
+			if (member.ToLocalChecked()->IsUndefined())
+			{
+				continue;
+			}
+
+			result.emplace_back(std::string { *Nan::Utf8String(key.ToLocalChecked()) },
+				makeResponseValue(member.ToLocalChecked(), ancestors, path));
+		}
+
+		return result;
+	}
+
+	throw std::invalid_argument("Unsupported variable value");
+}
+
+} // namespace
+
+response::Value makeResponseValue(v8::Local<v8::Value> value)
+{
+	Ancestors ancestors;
+	Path path;
+
+	return makeResponseValue(value, ancestors, path);
+}
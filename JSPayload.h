@@ -0,0 +1,70 @@
+#pragma once
+
+#ifndef JSPAYLOAD_H
+#define JSPAYLOAD_H
+
+#include "PayloadChannel.h"
+
+#include "graphqlservice/internal/Schema.h"
+
+#include <nan.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// How a result is handed to the next callback.
+enum class PayloadOutput
+{
+	// Copy the JSON into a regular V8 string.
+	String,
+
+	// Hand the JSON buffer over to V8 without copying it: as an external one-byte string if it's
+	// pure ASCII, or as a Buffer of UTF-8 bytes otherwise. The native buffer is released by a V8
+	// finalizer once JS drops the last reference. Electron doesn't allow a Buffer over external
+	// memory, so there the non-ASCII payloads are copied into a Buffer which V8 owns.
+	External,
+
+	// Skip JSON entirely and build plain JS objects and arrays from the response document. The
+	// result can be passed straight through structured clone (e.g. IPC) without JSON.parse.
+	Object,
+};
+
+// Internalized V8 strings for every field name in the schema, so converting a document to JS
+// objects doesn't allocate a new key string for each field of each object. Must be created and
+// destroyed on the main thread.
+class FieldNameCache
+{
+public:
+	explicit FieldNameCache(std::shared_ptr<const graphql::schema::Schema> schema);
+
+	v8::Local<v8::String> Lookup(std::string_view name) const;
+
+private:
+	void Add(std::string_view name);
+
+	// Keeps the string_view keys alive.
+	const std::shared_ptr<const graphql::schema::Schema> _schema;
+
+	std::unordered_map<std::string_view, Nan::Global<v8::String>> _names;
+};
+
+// Check whether the runtime which loaded the module allows a Buffer over memory which V8 doesn't
+// own. Must be called on the main thread when the module is loaded, before any External payloads.
+void detectExternalBuffers();
+
+// Must be called on the main thread inside a HandleScope.
+v8::Local<v8::Value> makeJSPayload(
+	PayloadChannel::Payload&& payload, PayloadOutput output, const FieldNameCache& names);
+
+// The reverse direction, for variables passed in as plain JS objects instead of a JSON string.
+// Strings, numbers, booleans, null, arrays and objects map to the same values parseJSON would
+// produce, and a Uint8Array or Buffer becomes a binary ID. An object with a toJSON method, like a
+// Date, is replaced with its result as it would be by JSON.stringify, and NaN or Infinity becomes
+// null. Throws std::invalid_argument for a cycle, or anything nested more than 256 levels deep,
+// instead of running out of stack, and for a getter, Proxy trap or toJSON which throws, with the
+// path to the value in the message. Must be called on the main thread.
+graphql::response::Value makeResponseValue(v8::Local<v8::Value> value);
+
+#endif // JSPAYLOAD_H
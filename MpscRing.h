@@ -0,0 +1,143 @@
+#pragma once
+
+#ifndef MPSCRING_H
+#define MPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Bounded lock-free queue for many producer threads and a single consumer. Each slot carries a
+// sequence number which tells a producer whether the slot is free for its position and tells the
+// consumer whether the value at its position has been published, so producers only contend on one
+// compare-and-swap of the enqueue position and never on a lock.
+template <typename T>
+class MpscRing
+{
+public:
+	// The capacity is rounded up to a power of 2.
+	explicit MpscRing(size_t capacity)
+		: _mask(roundUp(capacity) - 1)
+		, _slots(_mask + 1)
+	{
+		for (size_t i = 0; i < _slots.size(); ++i)
+		{
+			_slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	MpscRing(const MpscRing&) = delete;
+	MpscRing& operator=(const MpscRing&) = delete;
+
+	// Called on any thread. Returns false without consuming the value if the ring is full.
+	bool TryPush(T&& value)
+	{
+		auto position = _enqueuePosition.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			auto& slot = _slots[position & _mask];
+			const auto sequence = slot.sequence.load(std::memory_order_acquire);
+			const auto difference =
+				static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+
+			if (difference == 0)
+			{
+				if (_enqueuePosition.compare_exchange_weak(position,
+						position + 1,
+						std::memory_order_relaxed))
+				{
+					slot.value = std::move(value);
+					slot.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+			{
+				// The consumer hasn't freed this slot since the last time around.
+				return false;
+			}
+			else
+			{
+				position = _enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Only called by the consumer. If a producer has already claimed the next position but hasn't
+	// finished writing it yet, this waits for it rather than reporting the ring as empty, so
+	// anything the same producer queues afterwards can't be seen first.
+	std::optional<T> TryPop()
+	{
+		const auto position = _dequeuePosition.load(std::memory_order_relaxed);
+		auto& slot = _slots[position & _mask];
+
+		while (slot.sequence.load(std::memory_order_acquire) != position + 1)
+		{
+			if (_enqueuePosition.load(std::memory_order_acquire) == position)
+			{
+				return std::nullopt;
+			}
+
+			std::this_thread::yield();
+		}
+
+		std::optional<T> result { std::move(slot.value) };
+
+		slot.value = T {};
+		slot.sequence.store(position + _mask + 1, std::memory_order_release);
+		_dequeuePosition.store(position + 1, std::memory_order_relaxed);
+
+		return result;
+	}
+
+	bool Empty() const noexcept
+	{
+		return _enqueuePosition.load() == _dequeuePosition.load();
+	}
+
+	// Only a snapshot, producers and the consumer may be moving the positions at the same time.
+	size_t Size() const noexcept
+	{
+		const auto dequeuePosition = _dequeuePosition.load(std::memory_order_relaxed);
+		const auto enqueuePosition = _enqueuePosition.load(std::memory_order_relaxed);
+
+		return enqueuePosition > dequeuePosition ? enqueuePosition - dequeuePosition : 0;
+	}
+
+	size_t Capacity() const noexcept
+	{
+		return _slots.size();
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<size_t> sequence { 0 };
+		T value {};
+	};
+
+	static size_t roundUp(size_t capacity) noexcept
+	{
+		size_t result = 2;
+
+		while (result < capacity)
+		{
+			result <<= 1;
+		}
+
+		return result;
+	}
+
+	const size_t _mask;
+	std::vector<Slot> _slots;
+
+	// Keep the producers' position and the consumer's position on separate cache lines.
+	alignas(64) std::atomic<size_t> _enqueuePosition { 0 };
+	alignas(64) std::atomic<size_t> _dequeuePosition { 0 };
+};
+
+#endif // MPSCRING_H
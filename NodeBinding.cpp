@@ -1,17 +1,41 @@
 #include "graphqlservice/JSONResponse.h"
 
+#include "IntrospectionCache.h"
+#include "JSPayload.h"
+#include "MpscRing.h"
+#include "NodeIndex.h"
+#include "PayloadChannel.h"
+#include "QueryRegistry.h"
+#include "RequestTracer.h"
+#include "ResponseCache.h"
+#include "ResolverExecutor.h"
+#include "SchemaLoader.h"
+#include "ServiceMetrics.h"
+#include "SubscriptionDispatcher.h"
+#include "SubscriptionIndex.h"
 #include "TodayMock.h"
 
 #include <nan.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
 #include <iostream>
+#include <iterator>
 #include <map>
 #include <memory>
-#include <queue>
+#include <optional>
+#include <set>
+#include <sstream>
 #include <thread>
+#include <variant>
+#include <vector>
 
-using Nan::AsyncProgressQueueWorker;
-using Nan::AsyncQueueWorker;
 using Nan::Callback;
 using Nan::DecodeWrite;
 using Nan::Encoding;
@@ -25,63 +49,136 @@ using v8::Function;
 using v8::FunctionTemplate;
 using v8::Int32;
 using v8::Local;
+using v8::Object;
 using v8::Promise;
 using v8::String;
 using v8::Value;
 
 using namespace graphql;
 
-static std::shared_ptr<today::Appointment> appointment;
-static std::shared_ptr<today::Task> task;
-static std::shared_ptr<today::Folder> folder;
+struct SubscriptionPayloadQueue;
 
-static std::map<response::IdType, std::shared_ptr<today::object::Node>> nodes;
+// Everything which belongs to one instance of the addon. Each Node environment which loads the
+// module (the main thread and every worker_thread) gets its own, so they can run independent
+// services side by side. It's created in Init and deleted by the environment cleanup hook, and the
+// threads it owns are joined before that, so they can safely hold a plain reference to it.
+struct ServiceInstance
+{
+	explicit ServiceInstance(uv_loop_t* loop)
+		: payloadChannel { new PayloadChannel(loop) }
+	{
+	}
+
+	~ServiceInstance()
+	{
+		Stop();
+
+		// Release the internalized strings while the isolate is still alive.
+		fieldNameCache.reset();
+		payloadChannel->Close();
+	}
+
+	void Stop();
+
+	std::shared_ptr<today::Appointment> appointment;
+	std::shared_ptr<today::Task> task;
+	std::shared_ptr<today::Folder> folder;
+	NodeIndex nodes;
+
+	std::shared_ptr<today::Operations> service;
+	std::unique_ptr<ResolverExecutor> resolverExecutor;
+
+	// Delivers the change events from mutations to the matching subscriptions, one event at a time
+	// in the order they were queued, so a mutation doesn't wait for its subscribers to be resolved.
+	std::unique_ptr<ResolverExecutor> deliveryExecutor;
+	std::unique_ptr<SubscriptionDispatcher> subscriptionDispatcher;
+
+	// Shared by every request for the lifetime of the instance. It deletes itself after Close.
+	PayloadChannel* const payloadChannel;
+
+	// Only touched on the thread which owns the environment.
+	std::unique_ptr<FieldNameCache> fieldNameCache;
+
+	QueryRegistry queryRegistry;
+	std::map<std::int32_t, std::shared_ptr<SubscriptionPayloadQueue>> subscriptionMap;
+
+	// Keyed by the schema as well, so it stays valid across stopService and startService.
+	IntrospectionCache introspectionCache;
+
+	// Only created if startService was given a responseCacheBytes limit.
+	std::unique_ptr<ResponseCache> responseCache;
 
-static std::shared_ptr<today::Operations> serviceSingleton;
+	// Subscriptions by the id argument of their nodeChange field.
+	SubscriptionIndex subscriptionIndex;
 
-void loadAppointments()
+	// Totals across every subscription, reported by getSubscriptionStats.
+	std::atomic<std::uint64_t> droppedPayloads { 0 };
+	std::atomic<std::uint64_t> conflatedPayloads { 0 };
+
+	// Latency histograms reported by getMetrics. They keep accumulating across stopService and
+	// startService for the lifetime of the instance.
+	ServiceMetrics metrics;
+};
+
+// The instance is bound to each exported function as its data.
+ServiceInstance& getInstance(const Nan::FunctionCallbackInfo<Value>& info)
+{
+	return *static_cast<ServiceInstance*>(info.Data().As<v8::External>()->Value());
+}
+
+void loadAppointments(ServiceInstance& instance)
 {
 	std::string fakeAppointmentId("fakeAppointmentId");
 	response::IdType binAppointmentId(fakeAppointmentId.size());
 	std::copy(fakeAppointmentId.cbegin(), fakeAppointmentId.cend(), binAppointmentId.begin());
 
-	appointment = std::make_shared<today::Appointment>(std::move(binAppointmentId),
+	instance.appointment = std::make_shared<today::Appointment>(std::move(binAppointmentId),
 		"tomorrow",
 		"Lunch?",
 		false);
 
-	nodes[appointment->id()] = std::make_shared<today::object::Node>(
-		std::make_shared<today::object::Appointment>(appointment));
+	instance.nodes.Insert(instance.appointment->id(),
+		NodeIndex::NodeType::Appointment,
+		std::make_shared<today::object::Node>(
+			std::make_shared<today::object::Appointment>(instance.appointment)));
 };
 
-void loadTasks()
+void loadTasks(ServiceInstance& instance)
 {
 	std::string fakeTaskId("fakeTaskId");
 	response::IdType binTaskId(fakeTaskId.size());
 	std::copy(fakeTaskId.cbegin(), fakeTaskId.cend(), binTaskId.begin());
 
-	task = std::make_shared<today::Task>(std::move(binTaskId), "Don't forget", true);
+	instance.task = std::make_shared<today::Task>(std::move(binTaskId), "Don't forget", true);
 
-	nodes[task->id()] =
-		std::make_shared<today::object::Node>(std::make_shared<today::object::Task>(task));
+	instance.nodes.Insert(instance.task->id(),
+		NodeIndex::NodeType::Task,
+		std::make_shared<today::object::Node>(
+			std::make_shared<today::object::Task>(instance.task)));
 }
 
-void loadUnreadCounts()
+void loadUnreadCounts(ServiceInstance& instance)
 {
 	std::string fakeFolderId("fakeFolderId");
 	response::IdType binFolderId(fakeFolderId.size());
 	std::copy(fakeFolderId.cbegin(), fakeFolderId.cend(), binFolderId.begin());
 
-	folder = std::make_shared<today::Folder>(std::move(binFolderId), "\"Fake\" Inbox", 3);
+	instance.folder =
+		std::make_shared<today::Folder>(std::move(binFolderId), "\"Fake\" Inbox", 3);
 
-	nodes[folder->id()] =
-		std::make_shared<today::object::Node>(std::make_shared<today::object::Folder>(folder));
+	instance.nodes.Insert(instance.folder->id(),
+		NodeIndex::NodeType::Folder,
+		std::make_shared<today::object::Node>(
+			std::make_shared<today::object::Folder>(instance.folder)));
 }
 
 class MockSubscription
 {
 public:
-	explicit MockSubscription() = default;
+	explicit MockSubscription(const NodeIndex& nodes)
+		: _nodes { nodes }
+	{
+	}
 
 	std::shared_ptr<today::object::Appointment> getNextAppointmentChange() const
 	{
@@ -90,59 +187,344 @@ public:
 
 	std::shared_ptr<today::object::Node> getNodeChange(response::IdType&& nodeId) const
 	{
-		auto itr = nodes.find(nodeId);
+		const auto entry = _nodes.Find(nodeId);
+
+		return entry ? entry->node : std::shared_ptr<today::object::Node> {};
+	}
+
+private:
+	const NodeIndex& _nodes;
+};
+
+static constexpr std::string_view strNodeChange = "nodeChange";
+
+// Passed to resolve for each fetchQuery, so resolvers can see the per-request options.
+struct FetchState
+	: service::RequestState
+	, today::RequestObserver
+{
+	explicit FetchState(bool awaitDelivery, bool trackNodes = false,
+		std::shared_ptr<RequestTracer> tracer = {})
+		: today::RequestObserver { trackNodes, static_cast<bool>(tracer) }
+		, awaitDelivery { awaitDelivery }
+		, tracer { std::move(tracer) }
+	{
+	}
+
+	void TrackNode(const response::IdType& id) override
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		nodeIds.insert(id);
+	}
+
+	void BeginSelectionSet(
+		std::string_view typeName, const service::SelectionSetParams& params) override
+	{
+		tracer->BeginSelectionSet(typeName, params);
+	}
 
-		return itr == nodes.end() ? std::shared_ptr<today::object::Node> {} : itr->second;
+	void EndSelectionSet(const service::SelectionSetParams& params) override
+	{
+		tracer->EndSelectionSet(params);
 	}
+
+	// Keep the mutation from returning until its subscriptions have been resolved.
+	const bool awaitDelivery;
+
+	// The ids of the nodes the query resolved with trackNodes, to tag its entry in the
+	// ResponseCache.
+	std::mutex mutex;
+	std::set<response::IdType> nodeIds;
+
+	// Record the timing of each object in the response for the tracing extension.
+	const std::shared_ptr<RequestTracer> tracer;
 };
 
+// Set on the deliveryExecutor thread while it delivers the event for a mutation with the
+// awaitDelivery option. The delivery resolves the subscriptions synchronously, and they hand their
+// payloads straight to the PayloadChannel instead of waiting for the SubscriptionDispatcher.
+thread_local bool t_flushDeliveries = false;
+
+// Hand a change event to the deliveryExecutor. Events always go through the same queue, so they are
+// delivered in the order the mutations queued them. If the queue is full, the mutation waits for
+// room, which pushes back on whoever is producing the events.
+//
+// With awaitDelivery, the mutation also waits until every matching subscription has passed its
+// payload to the PayloadChannel, or dropped it under its overflow policy. The PayloadChannel is a
+// single FIFO, so those payloads reach their next callbacks before the mutation's own result.
+void queueDelivery(
+	ResolverExecutor& deliveryExecutor, ResolverExecutor::Task&& delivery, bool awaitDelivery)
+{
+	if (!awaitDelivery)
+	{
+		deliveryExecutor.PostWait(std::move(delivery));
+		return;
+	}
+
+	auto delivered = std::make_shared<std::promise<void>>();
+	auto future = delivered->get_future();
+
+	if (!deliveryExecutor.PostWait([delivery = std::move(delivery), delivered]() {
+			t_flushDeliveries = true;
+
+			try
+			{
+				delivery();
+				delivered->set_value();
+			}
+			catch (...)
+			{
+				delivered->set_exception(std::current_exception());
+			}
+
+			t_flushDeliveries = false;
+		}))
+	{
+		// The service is shutting down, so nobody is listening for the event anymore.
+		return;
+	}
+
+	future.get();
+}
+
+// Convert a JS number to a size, or throw std::invalid_argument if it isn't an integer between 0
+// and maxValue.
+size_t getSizeValue(Local<Value> value, const char* name, size_t maxValue)
+{
+	const auto number = value->IsNumber() ? value.As<v8::Number>()->Value() : -1.0;
+
+	if (!std::isfinite(number) || number < 0.0 || number != std::trunc(number)
+		|| number > static_cast<double>(maxValue))
+	{
+		throw std::invalid_argument(std::string { "Invalid " } + name + " option");
+	}
+
+	return static_cast<size_t>(number);
+}
+
+// Read an optional size from the options object passed to startService. Leaving it out or passing
+// 0 keeps the default.
+size_t getSizeOption(Local<Object> options, const char* name, size_t defaultValue, size_t maxValue)
+{
+	auto value = Nan::Get(options, New<String>(name).ToLocalChecked()).ToLocalChecked();
+
+	if (value->IsUndefined())
+	{
+		return defaultValue;
+	}
+
+	const auto size = getSizeValue(value, name, maxValue);
+
+	return size > 0 ? size : defaultValue;
+}
+
+// Upper bounds for the startService options, well past anything useful, but low enough that a
+// typo doesn't try to start millions of threads or reserve the address space.
+constexpr size_t MaxThreads = 1024;
+constexpr size_t MaxQueueDepth = size_t { 1 } << 24;
+constexpr std::uint64_t MaxCacheBytes = std::uint64_t { 1 } << 40;
+
+// Number.MAX_SAFE_INTEGER, or SIZE_MAX if that's smaller.
+constexpr size_t MaxSafeSize =
+	static_cast<size_t>(std::min<std::uint64_t>((std::uint64_t { 1 } << 53) - 1, SIZE_MAX));
+
 NAN_METHOD(startService)
 {
-	loadAppointments();
-	loadTasks();
-	loadUnreadCounts();
+	auto& instance = getInstance(info);
+	size_t resolverThreads = ResolverExecutor::DefaultThreadCount();
+	size_t resolverQueueDepth = ResolverExecutor::DefaultQueueDepth;
+	size_t dispatcherThreads = SubscriptionDispatcher::DefaultThreadCount;
+	size_t deliveryQueueDepth = ResolverExecutor::DefaultQueueDepth;
+	size_t responseCacheBytes = 0;
+
+	if (info.Length() > 0 && info[0]->IsObject())
+	{
+		auto options = To<Object>(info[0]).ToLocalChecked();
+
+		try
+		{
+			resolverThreads =
+				getSizeOption(options, "resolverThreads", resolverThreads, MaxThreads);
+			resolverQueueDepth =
+				getSizeOption(options, "resolverQueueDepth", resolverQueueDepth, MaxQueueDepth);
+			dispatcherThreads =
+				getSizeOption(options, "dispatcherThreads", dispatcherThreads, MaxThreads);
+			deliveryQueueDepth =
+				getSizeOption(options, "deliveryQueueDepth", deliveryQueueDepth, MaxQueueDepth);
+			responseCacheBytes = getSizeOption(options,
+				"responseCacheBytes",
+				responseCacheBytes,
+				static_cast<size_t>(std::min<std::uint64_t>(MaxCacheBytes, SIZE_MAX)));
+		}
+		catch (const std::exception& ex)
+		{
+			Nan::ThrowError(ex.what());
+			return;
+		}
+	}
+
+	// Usually this was already built in the background while the app was starting up. The generated
+	// objects and the service pick up the same instance through today::GetSchema.
+	const auto schema = getSchema();
+
+	loadAppointments(instance);
+	loadTasks(instance);
+	loadUnreadCounts(instance);
 
 	auto query = std::make_shared<today::Query>(
-		[]() -> std::vector<std::shared_ptr<today::Appointment>> {
-			return { appointment };
+		[&instance]() -> std::vector<std::shared_ptr<today::Appointment>> {
+			return { instance.appointment };
+		},
+		[&instance]() -> std::vector<std::shared_ptr<today::Task>> {
+			return { instance.task };
 		},
-		[]() -> std::vector<std::shared_ptr<today::Task>> {
-			return { task };
+		[&instance]() -> std::vector<std::shared_ptr<today::Folder>> {
+			return { instance.folder };
 		},
-		[]() -> std::vector<std::shared_ptr<today::Folder>> {
-			return { folder };
+		[&instance](const response::IdType& id) -> std::optional<today::NodeType> {
+			const auto entry = instance.nodes.Find(id);
+
+			return entry ? std::make_optional(entry->type) : std::nullopt;
 		});
 	auto mutation = std::make_shared<today::Mutation>(
-		[](today::CompleteTaskInput&& input) -> std::shared_ptr<today::CompleteTaskPayload> {
-			auto itr = nodes.find(input.id);
-
-			if (itr == nodes.end())
+		[&instance](const std::shared_ptr<service::RequestState>& state,
+			today::CompleteTaskInput&& input) -> std::shared_ptr<today::CompleteTaskPayload> {
+			if (!instance.nodes.Find(input.id))
 			{
 				return nullptr;
 			}
 
-			service::SubscriptionArguments arguments;
+			const auto fetchState = std::dynamic_pointer_cast<FetchState>(state);
 
-			arguments["id"] = response::Value(std::move(input.id));
-			serviceSingleton
-				->deliver({ "nodeChange",
-					{ service::SubscriptionFilter { { std::move(arguments) } } },
-					std::launch::async,
-					std::make_shared<today::object::Subscription>(
-						std::make_shared<MockSubscription>()) })
-				.get();
+			if (instance.responseCache)
+			{
+				instance.responseCache->Invalidate(input.id);
+			}
 
-			return std::make_shared<today::CompleteTaskPayload>(task,
+			queueDelivery(
+				*instance.deliveryExecutor,
+				[&instance, id = std::move(input.id), queued = LatencyHistogram::Clock::now()]() {
+					instance.metrics.deliveryLag.Record(LatencyHistogram::Clock::now() - queued);
+
+					auto subscriptionObject = std::make_shared<today::object::Subscription>(
+						std::make_shared<MockSubscription>(instance.nodes));
+					const auto keys = instance.subscriptionIndex.Find(strNodeChange, id);
+					const auto launch = t_flushDeliveries
+						? service::await_async {}
+						: service::await_async { std::launch::async };
+
+					if (!keys)
+					{
+						// Fall back to testing the filter against every nodeChange subscription.
+						service::SubscriptionArguments arguments;
+
+						arguments["id"] = response::Value(response::IdType { id });
+						instance.service
+							->deliver({ strNodeChange,
+								{ service::SubscriptionFilter { { std::move(arguments) } } },
+								launch,
+								std::move(subscriptionObject) })
+							.get();
+						return;
+					}
+
+					for (const auto key : *keys)
+					{
+						instance.service
+							->deliver({ strNodeChange,
+								{ key },
+								launch,
+								subscriptionObject })
+							.get();
+					}
+				},
+				fetchState && fetchState->awaitDelivery);
+
+			return std::make_shared<today::CompleteTaskPayload>(instance.task,
 				std::move(input.clientMutationId));
 		});
 
-	serviceSingleton = std::make_shared<today::Operations>(std::move(query),
+	instance.service = std::make_shared<today::Operations>(std::move(query),
 		std::move(mutation),
 		std::shared_ptr<today::Subscription> {});
+	instance.resolverExecutor =
+		std::make_unique<ResolverExecutor>(resolverThreads, resolverQueueDepth);
+	instance.deliveryExecutor = std::make_unique<ResolverExecutor>(1, deliveryQueueDepth);
+	instance.subscriptionDispatcher =
+		std::make_unique<SubscriptionDispatcher>(dispatcherThreads);
+	instance.responseCache = responseCacheBytes > 0
+		? std::make_unique<ResponseCache>(responseCacheBytes)
+		: std::unique_ptr<ResponseCache> {};
+
+	if (!instance.fieldNameCache)
+	{
+		instance.fieldNameCache = std::make_unique<FieldNameCache>(schema);
+	}
+}
+
+// What a bounded subscription does with a new payload when it already has as many undelivered
+// payloads as its capacity allows.
+enum class OverflowPolicy
+{
+	// Drop the oldest payload which hasn't been handed to the PayloadChannel yet, or the new one if
+	// they are all already on their way to the main thread.
+	DropOldest,
+
+	// Replace a pending payload for the same node (the id of the subscription field) with the new
+	// one, and then fall back to DropOldest.
+	LatestWins,
+
+	// Make the thread delivering the event wait until the main thread catches up.
+	Block,
+};
+
+// The id of the node in a payload like { data: { nodeChange: { id } } }, or null if there isn't
+// one.
+const response::Value* getConflationKey(const response::Value& document)
+{
+	if (document.type() != response::Type::Map)
+	{
+		return nullptr;
+	}
+
+	const auto data = document.find(service::strData);
+
+	if (data == document.end() || data->second.type() != response::Type::Map
+		|| data->second.size() == 0)
+	{
+		return nullptr;
+	}
+
+	const auto& field = data->second.begin()->second;
+
+	if (field.type() != response::Type::Map)
+	{
+		return nullptr;
+	}
+
+	const auto id = field.find("id");
+
+	return id == field.end() ? nullptr : &id->second;
+}
+
+bool matchConflationKey(const response::Value* lhs, const response::Value* rhs)
+{
+	return (lhs == nullptr || rhs == nullptr) ? lhs == rhs : *lhs == *rhs;
 }
 
-struct SubscriptionPayloadQueue : std::enable_shared_from_this<SubscriptionPayloadQueue>
+// Shared between the main thread, which owns the JS callbacks, and whichever thread produces the
+// serialized payloads: a ResolverExecutor thread for queries and mutations, or a
+// SubscriptionDispatcher thread for subscriptions.
+struct SubscriptionPayloadQueue
+	: SubscriptionDispatcher::Target
+	, std::enable_shared_from_this<SubscriptionPayloadQueue>
 {
+	explicit SubscriptionPayloadQueue(ServiceInstance& instance)
+		: instance { instance }
+	{
+	}
+
 	~SubscriptionPayloadQueue()
 	{
 		Unsubscribe();
@@ -162,266 +544,1290 @@ struct SubscriptionPayloadQueue : std::enable_shared_from_this<SubscriptionPaylo
 		auto deferUnsubscribe = std::move(key);
 
 		lock.unlock();
-		condition.notify_one();
+		Complete();
 
-		if (deferUnsubscribe && serviceSingleton)
+		if (deferUnsubscribe && instance.service)
 		{
-			serviceSingleton->unsubscribe({ *deferUnsubscribe }).get();
+			instance.subscriptionIndex.Remove(*deferUnsubscribe);
+			instance.service->unsubscribe({ *deferUnsubscribe }).get();
 		}
 	}
 
-	std::mutex mutex;
-	std::condition_variable condition;
-	std::queue<response::AwaitableValue> payloads;
-	std::optional<service::SubscriptionKey> key;
-	bool registered = false;
-};
-
-static std::map<std::int32_t, peg::ast> queryMap;
-static std::map<std::int32_t, std::shared_ptr<SubscriptionPayloadQueue>> subscriptionMap;
-
-NAN_METHOD(stopService)
-{
-	if (serviceSingleton)
+	// Called from the subscription callback on whichever thread is delivering the event. We only
+	// queue the document here, serializing it is left to the SubscriptionDispatcher. Unbounded
+	// subscriptions have a lock-free ring in front of the pending queue, and only take the lock
+	// when the ring is full. The ring skips the lock, so it can race with Complete, but a payload
+	// which slips into the ring after that is dropped by Send, which checks completed under the
+	// lock before anything reaches the PayloadChannel.
+	void Deliver(response::Value&& payload)
 	{
-		for (const auto& entry : subscriptionMap)
+		if (t_flushDeliveries)
 		{
-			entry.second->Unsubscribe();
+			Flush(std::move(payload));
+			return;
 		}
 
-		subscriptionMap.clear();
-		queryMap.clear();
-		serviceSingleton.reset();
-	}
-}
+		if (ring && !completed.load() && !overflowed.load() && ring->TryPush(std::move(payload)))
+		{
+			ScheduleDispatch();
+			return;
+		}
 
-NAN_METHOD(parseQuery)
-{
-	std::string query(*Nan::Utf8String(To<String>(info[0]).ToLocalChecked()));
-	const std::int32_t queryId = (queryMap.empty() ? 1 : queryMap.crbegin()->first + 1);
+		std::unique_lock<std::mutex> lock(mutex);
 
-	try
-	{
-		auto ast = peg::parseString(query);
-		auto validationErrors = serviceSingleton->validate(ast);
+		if (completed || !MakeRoom(lock, payload))
+		{
+			return;
+		}
 
-		if (!validationErrors.empty())
+		// Anything this thread delivers next has to go through pending as well, until Dispatch
+		// catches up, or it could overtake this payload in the ring.
+		if (ring)
 		{
-			throw service::schema_exception { std::move(validationErrors) };
+			overflowed.store(true);
 		}
 
-		queryMap[queryId] = std::move(ast);
-		info.GetReturnValue().Set(New<Int32>(queryId));
-	}
-	catch (const std::exception& ex)
-	{
-		Nan::ThrowError(ex.what());
+		pending.push_back(std::move(payload));
+		lock.unlock();
+		ScheduleDispatch();
 	}
-}
-
-NAN_METHOD(discardQuery)
-{
-	const auto queryId = To<std::int32_t>(info[0]).FromJust();
-
-	queryMap.erase(queryId);
-}
 
-class RegisteredSubscription : public AsyncProgressQueueWorker<std::string>
-{
-public:
-	explicit RegisteredSubscription(std::int32_t queryId, std::string&& operationName,
-		const std::string& variables, std::unique_ptr<Callback>&& next,
-		std::unique_ptr<Callback>&& complete)
-		: AsyncProgressQueueWorker(complete.release(), "graphql:subscription")
-		, _next { std::move(next) }
+	void Dispatch() noexcept override
 	{
-		try
+		while (true)
 		{
-			_payloadQueue = std::make_shared<SubscriptionPayloadQueue>();
-
-			const auto itrQuery = queryMap.find(queryId);
+			std::unique_lock<std::mutex> sendLock(sendMutex);
+			std::unique_lock<std::mutex> lock(mutex);
+			auto documents = TakeQueued();
 
-			if (itrQuery == queryMap.cend())
+			if (documents.empty())
 			{
-				throw std::runtime_error("Unknown queryId");
-			}
+				dispatching.store(false);
+				lock.unlock();
 
-			auto& ast = itrQuery->second;
-			auto parsedVariables = (variables.empty() ? response::Value(response::Type::Map)
-													  : response::parseJSON(variables));
+				// A producer which pushed to the ring after we drained it may have seen that we
+				// were still dispatching, so check again before we stop.
+				if (ring && !ring->Empty() && !dispatching.exchange(true))
+				{
+					continue;
+				}
 
-			if (parsedVariables.type() != response::Type::Map)
-			{
-				throw std::runtime_error("Invalid variables object");
+				return;
 			}
 
-			std::unique_lock<std::mutex> lock(_payloadQueue->mutex);
-
-			if (serviceSingleton->findOperationDefinition(ast, operationName).first
-				== service::strSubscription)
-			{
-				_payloadQueue->registered = true;
-				_payloadQueue->key = std::make_optional(
-					serviceSingleton
-						->subscribe(
-							{ [spQueue = _payloadQueue](response::Value payload) noexcept -> void {
-								 std::unique_lock<std::mutex> lock(spQueue->mutex);
-
-								 if (!spQueue->registered)
-								 {
-									 return;
-								 }
-
-								 std::promise<response::Value> promise;
-
-								 promise.set_value(std::move(payload));
-								 spQueue->payloads.push(promise.get_future());
+			lock.unlock();
 
-								 lock.unlock();
-								 spQueue->condition.notify_one();
-							 },
-								peg::ast { ast },
-								std::move(operationName),
-								std::move(parsedVariables) })
-						.get());
-			}
-			else
+			for (auto& document : documents)
 			{
-				_payloadQueue->payloads.push(
-					serviceSingleton->resolve({ ast, operationName, std::move(parsedVariables) }));
-
-				lock.unlock();
-				_payloadQueue->condition.notify_one();
+				Send(std::move(document));
 			}
 		}
-		catch (const std::exception& ex)
+	}
+
+	void Push(response::Value&& document)
+	{
 		{
-			std::cerr << "Caught exception preparing the subscription: " << ex.what() << std::endl;
+			std::lock_guard<std::mutex> lock(mutex);
+
+			++inFlight;
 		}
+
+		Send(std::move(document));
 	}
 
-	~RegisteredSubscription()
+	// A result from the IntrospectionCache or the ResponseCache, which is already serialized
+	// unless the receiver wants the document itself.
+	template <class Result>
+	void PushCached(const Result& result)
 	{
-		if (_payloadQueue)
 		{
-			_payloadQueue->Unsubscribe();
+			std::lock_guard<std::mutex> lock(mutex);
+
+			++inFlight;
 		}
+
+		Send(output == PayloadOutput::Object
+				? PayloadChannel::Payload { std::in_place_type<response::Value>, result.document }
+				: PayloadChannel::Payload { std::in_place_type<std::string>, result.json });
 	}
 
-	const std::shared_ptr<SubscriptionPayloadQueue>& GetPayloadQueue() const
+	// Called on the main thread once a payload has been passed to the next callback.
+	void Acknowledge()
 	{
-		return _payloadQueue;
+		std::lock_guard<std::mutex> lock(mutex);
+
+		--inFlight;
+
+		if (overflow == OverflowPolicy::Block)
+		{
+			space.notify_all();
+		}
 	}
 
-private:
-	// Executed inside the worker-thread.
-	// It is not safe to access V8, or V8 data structures
-	// here, so everything we need for input and output
-	// should go on `this`.
-	void Execute(const ExecutionProgress& progress) override
+	// No more payloads will be pushed, let the main thread know so it can call complete.
+	void Complete()
 	{
-		auto spQueue = _payloadQueue;
-		bool registered = true;
+		std::lock_guard<std::mutex> lock(mutex);
 
-		while (registered)
+		if (completed)
 		{
-			std::unique_lock<std::mutex> lock(spQueue->mutex);
+			return;
+		}
 
-			spQueue->condition.wait(lock, [spQueue]() noexcept -> bool {
-				return !spQueue->registered || !spQueue->payloads.empty();
-			});
+		completed = true;
+		space.notify_all();
+		instance.payloadChannel->SendComplete(receiver);
+	}
 
-			auto payloads = std::move(spQueue->payloads);
+	// Slots in the lock-free ring of an unbounded subscription.
+	static constexpr size_t RingCapacity = 16;
 
-			registered = spQueue->registered;
-			lock.unlock();
+	ServiceInstance& instance;
+	std::mutex mutex;
+	// Held from taking the queued payloads until they are sent, so Dispatch and Flush can't
+	// reorder them. Always taken before mutex.
+	std::mutex sendMutex;
+	std::condition_variable space;
+	std::unique_ptr<MpscRing<response::Value>> ring;
+	std::atomic<bool> overflowed { false };
+	std::deque<response::Value> pending;
+	std::optional<service::SubscriptionKey> key;
+	bool registered = false;
+	// Only written with the lock held, but the ring in Deliver reads it without the lock.
+	std::atomic<bool> completed { false };
+	std::atomic<bool> dispatching { false };
+	PayloadOutput output = PayloadOutput::String;
 
-			std::vector<std::string> json;
+	// Limit on pending plus in flight payloads, or 0 for no limit.
+	size_t capacity = 0;
+	OverflowPolicy overflow = OverflowPolicy::DropOldest;
 
-			while (!payloads.empty())
-			{
-				response::Value document { response::Type::Map };
-				auto payload = std::move(payloads.front());
+	// Payloads which have left pending, but haven't reached the next callback yet.
+	size_t inFlight = 0;
 
-				payloads.pop();
+	// Owned by the main thread, and only dereferenced there when the PayloadChannel calls back.
+	PayloadChannel::Receiver* receiver = nullptr;
 
-				try
-				{
-					document = payload.get();
-				}
-				catch (service::schema_exception& scx)
-				{
-					document.reserve(2);
-					document.emplace_back(std::string { service::strData }, {});
-					document.emplace_back(std::string { service::strErrors }, scx.getErrors());
-				}
-				catch (const std::exception& ex)
-				{
-					std::ostringstream oss;
+	// Only set for a query or mutation with the tracing option.
+	std::shared_ptr<RequestTracer> tracer;
 
-					oss << "Caught exception delivering subscription payload: " << ex.what();
-					document.reserve(2);
-					document.emplace_back(std::string { service::strData }, {});
-					document.emplace_back(std::string { service::strErrors },
-						response::Value { oss.str() });
-				}
+	// One of the ServiceMetrics::OperationNames, which is empty until the operation is found.
+	std::string_view operationType;
+
+private:
+	// Queue the payload behind anything that's already waiting for the SubscriptionDispatcher, and
+	// then send all of them from this thread, for a mutation with the awaitDelivery option.
+	void Flush(response::Value&& payload)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
 
-				json.push_back(response::toJSON(std::move(document)));
+			if (completed || !MakeRoom(lock, payload))
+			{
+				return;
 			}
 
-			if (!json.empty())
+			if (ring)
 			{
-				progress.Send(json.data(), json.size());
+				overflowed.store(true);
 			}
+
+			pending.push_back(std::move(payload));
+		}
+
+		std::lock_guard<std::mutex> sendLock(sendMutex);
+		std::unique_lock<std::mutex> lock(mutex);
+		auto documents = TakeQueued();
+
+		lock.unlock();
+
+		for (auto& document : documents)
+		{
+			Send(std::move(document));
 		}
 	}
 
-	// Executed when the async results are ready
-	// this function will be run inside the main event loop
-	// so it is safe to use V8 again
-	void HandleProgressCallback(const std::string* data, size_t size) override
+	// Move everything out of the ring and pending with the lock held, and count it as in flight.
+	std::vector<response::Value> TakeQueued()
 	{
-		if (data == nullptr)
+		std::vector<response::Value> documents;
+
+		// Drain the ring first, everything in pending was queued after the ring filled up.
+		if (ring)
 		{
-			return;
+			while (auto document = ring->TryPop())
+			{
+				documents.push_back(std::move(*document));
+			}
+
+			overflowed.store(false);
 		}
 
-		HandleScope scope;
+		documents.reserve(documents.size() + pending.size());
+		std::move(pending.begin(), pending.end(), std::back_inserter(documents));
+		pending.clear();
+		inFlight += documents.size();
 
-		while (size-- > 0)
-		{
-			Local<Value> argv[] = {
-				New<String>(data->c_str(), static_cast<int>(data->size())).ToLocalChecked()
-			};
+		return documents;
+	}
 
-			_next->Call(1, argv, async_resource);
-			++data;
+	// Only the thread which flips dispatching from false to true wakes the SubscriptionDispatcher,
+	// so a burst of payloads costs one wakeup.
+	void ScheduleDispatch()
+	{
+		if (!dispatching.exchange(true))
+		{
+			instance.subscriptionDispatcher->MarkReady(shared_from_this());
 		}
 	}
 
-	std::unique_ptr<Callback> _next;
-	std::shared_ptr<SubscriptionPayloadQueue> _payloadQueue;
-};
+	// Apply the overflow policy with the lock held. Conflation happens whether or not the queue is
+	// full. Returns false if the new payload should be dropped instead of queued.
+	bool MakeRoom(std::unique_lock<std::mutex>& lock, const response::Value& payload)
+	{
+		const auto full = [this]() noexcept -> bool {
+			return capacity > 0 && pending.size() + inFlight >= capacity;
+		};
 
-NAN_METHOD(fetchQuery)
-{
-	const auto queryId = To<std::int32_t>(info[0]).FromJust();
-	std::string operationName(*Nan::Utf8String(To<String>(info[1]).ToLocalChecked()));
-	std::string variables(*Nan::Utf8String(To<String>(info[2]).ToLocalChecked()));
-	auto next = std::make_unique<Callback>(To<Function>(info[3]).ToLocalChecked());
-	auto complete = std::make_unique<Callback>(To<Function>(info[4]).ToLocalChecked());
-	auto subscription = std::make_unique<RegisteredSubscription>(queryId,
+		switch (overflow)
+		{
+			case OverflowPolicy::Block:
+				space.wait(lock, [this, &full]() noexcept -> bool {
+					return completed || !full();
+				});
+
+				return !completed;
+
+			case OverflowPolicy::LatestWins:
+			{
+				const auto payloadKey = getConflationKey(payload);
+				const auto itr = std::find_if(pending.begin(),
+					pending.end(),
+					[payloadKey](const response::Value& document) {
+						return matchConflationKey(getConflationKey(document), payloadKey);
+					});
+
+				if (itr != pending.end())
+				{
+					pending.erase(itr);
+					++instance.conflatedPayloads;
+				}
+
+				[[fallthrough]];
+			}
+
+			case OverflowPolicy::DropOldest:
+			default:
+				while (full() && !pending.empty())
+				{
+					pending.pop_front();
+					++instance.droppedPayloads;
+				}
+
+				if (full())
+				{
+					++instance.droppedPayloads;
+					return false;
+				}
+
+				return true;
+		}
+	}
+
+	// Serialize the document unless the receiver is going to convert it directly to JS objects.
+	void Send(response::Value&& document)
+	{
+		if (output == PayloadOutput::Object)
+		{
+			Send(PayloadChannel::Payload { std::in_place_type<response::Value>,
+				std::move(document) });
+			return;
+		}
+
+		if (tracer)
+		{
+			tracer->BeginStage(RequestTracer::Stage::Serialization);
+		}
+
+		const auto start = LatencyHistogram::Clock::now();
+		auto json = response::toJSON(std::move(document));
+
+		instance.metrics.Record(ServiceMetrics::Stage::Serialize,
+			operationType,
+			LatencyHistogram::Clock::now() - start);
+
+		if (tracer)
+		{
+			tracer->EndStage(RequestTracer::Stage::Serialization);
+		}
+
+		Send(PayloadChannel::Payload { std::in_place_type<std::string>, std::move(json) });
+	}
+
+	void Send(PayloadChannel::Payload&& payload)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (completed)
+		{
+			return;
+		}
+
+		if (tracer)
+		{
+			tracer->BeginStage(RequestTracer::Stage::Delivery);
+		}
+
+		instance.payloadChannel->Send(receiver, std::move(payload));
+	}
+};
+
+void ServiceInstance::Stop()
+{
+	if (service)
+	{
+		for (const auto& entry : subscriptionMap)
+		{
+			entry.second->Unsubscribe();
+		}
+
+		subscriptionMap.clear();
+
+		// Let any queries which are still queued finish before we release the service, and then
+		// flush any subscription payloads they delivered. Clear the registry afterwards, so a
+		// parseQueryAsync which was still running doesn't register a document after the fact.
+		resolverExecutor.reset();
+		deliveryExecutor.reset();
+		subscriptionDispatcher.reset();
+
+		// Every thread which could read the nodes has been joined, so the tables they replaced
+		// can go.
+		nodes.Reclaim();
+		queryRegistry.Clear();
+		subscriptionIndex.Clear();
+		responseCache.reset();
+		service.reset();
+	}
+}
+
+NAN_METHOD(stopService)
+{
+	getInstance(info).Stop();
+}
+
+// Register the query and record how long it took to parse and validate, if it wasn't already
+// registered, including documents which fail validation.
+std::int32_t registerQuery(
+	ServiceInstance& instance, std::string_view query, service::Request& service)
+{
+	std::optional<QueryRegistry::Timings> timings;
+	const auto recordTimings = [&instance, &timings]() noexcept {
+		if (timings)
+		{
+			instance.metrics.Record(ServiceMetrics::Stage::Parse,
+				ServiceMetrics::OperationNames.front(),
+				timings->parse);
+			instance.metrics.Record(ServiceMetrics::Stage::Validate,
+				ServiceMetrics::OperationNames.front(),
+				timings->validate);
+		}
+	};
+
+	try
+	{
+		const auto queryId = instance.queryRegistry.Register(query, service, &timings);
+
+		recordTimings();
+
+		return queryId;
+	}
+	catch (...)
+	{
+		recordTimings();
+		throw;
+	}
+}
+
+NAN_METHOD(parseQuery)
+{
+	auto& instance = getInstance(info);
+	std::string query(*Nan::Utf8String(To<String>(info[0]).ToLocalChecked()));
+
+	try
+	{
+		const auto queryId = registerQuery(instance, query, *instance.service);
+
+		info.GetReturnValue().Set(New<Int32>(queryId));
+	}
+	catch (const std::exception& ex)
+	{
+		Nan::ThrowError(ex.what());
+	}
+}
+
+// Parses and validates the query on the ResolverExecutor, and settles the Promise on the main
+// thread once the PayloadChannel calls back.
+class PendingParse : public PayloadChannel::Receiver
+{
+public:
+	explicit PendingParse(ServiceInstance& instance, Local<Promise::Resolver> resolver)
+		: _instance { instance }
+		, _resolver { resolver }
+	{
+		_instance.payloadChannel->Acquire(this);
+	}
+
+	~PendingParse() override
+	{
+		_instance.payloadChannel->Release(this);
+	}
+
+	// Called on a worker thread. The result is only read in OnComplete, and the PayloadChannel
+	// lock orders these writes before that.
+	void Parse(std::string_view query, today::Operations& service) noexcept
+	{
+		try
+		{
+			_queryId = std::make_optional(registerQuery(_instance, query, service));
+		}
+		catch (const std::exception& ex)
+		{
+			_error = ex.what();
+		}
+
+		_instance.payloadChannel->SendComplete(this);
+	}
+
+	void Fail(std::string&& error) noexcept
+	{
+		_error = std::move(error);
+		_instance.payloadChannel->SendComplete(this);
+	}
+
+private:
+	// There are no intermediate payloads for a parse.
+	void OnPayload(PayloadChannel::Payload&&) override
+	{
+	}
+
+	void OnComplete() override
+	{
+		{
+			HandleScope scope;
+			auto resolver = New(_resolver);
+			auto context = Nan::GetCurrentContext();
+
+			// Run the microtask queue when we're done, or the continuations would wait for the
+			// next unrelated callback into JS.
+			node::CallbackScope callbackScope(v8::Isolate::GetCurrent(),
+				resolver->GetPromise(),
+				{ 0, 0 });
+
+			if (_queryId)
+			{
+				resolver->Resolve(context, New<Int32>(*_queryId)).FromJust();
+			}
+			else
+			{
+				resolver->Reject(context, Nan::Error(_error.c_str())).FromJust();
+			}
+		}
+
+		delete this;
+	}
+
+	ServiceInstance& _instance;
+	Nan::Global<Promise::Resolver> _resolver;
+	std::optional<std::int32_t> _queryId;
+	std::string _error;
+};
+
+NAN_METHOD(parseQueryAsync)
+{
+	auto& instance = getInstance(info);
+	auto query = std::make_shared<std::string>(
+		*Nan::Utf8String(To<String>(info[0]).ToLocalChecked()));
+	auto resolver = Promise::Resolver::New(Nan::GetCurrentContext()).ToLocalChecked();
+
+	info.GetReturnValue().Set(resolver->GetPromise());
+
+	// Deleted on the main thread after it settles the Promise.
+	auto pending = new PendingParse(instance, resolver);
+
+	if (!instance.resolverExecutor->Post([pending, query, service = instance.service]() noexcept {
+			pending->Parse(*query, *service);
+		}))
+	{
+		pending->Fail("Resolver queue is full");
+	}
+}
+
+// Register a document which has already been parsed by its hash alone. Returns null if the hash
+// is unknown, in which case the client should fall back to parseQuery with the full text.
+NAN_METHOD(parsePersistedQuery)
+{
+	std::string hash(*Nan::Utf8String(To<String>(info[0]).ToLocalChecked()));
+	const auto queryId = getInstance(info).queryRegistry.Register(hash);
+
+	if (queryId)
+	{
+		info.GetReturnValue().Set(New<Int32>(*queryId));
+	}
+	else
+	{
+		info.GetReturnValue().SetNull();
+	}
+}
+
+NAN_METHOD(getQueryHash)
+{
+	const auto queryId = To<std::int32_t>(info[0]).FromJust();
+	const auto entry = getInstance(info).queryRegistry.Find(queryId);
+
+	if (entry)
+	{
+		info.GetReturnValue().Set(New<String>(entry->hash).ToLocalChecked());
+	}
+	else
+	{
+		info.GetReturnValue().SetNull();
+	}
+}
+
+NAN_METHOD(discardQuery)
+{
+	const auto queryId = To<std::int32_t>(info[0]).FromJust();
+
+	getInstance(info).queryRegistry.Release(queryId);
+}
+
+response::Value buildErrorDocument(response::Value&& errors)
+{
+	response::Value document { response::Type::Map };
+
+	document.reserve(2);
+	document.emplace_back(std::string { service::strData }, {});
+	document.emplace_back(std::string { service::strErrors }, std::move(errors));
+
+	return document;
+}
+
+response::Value awaitDocument(response::AwaitableValue&& payload)
+{
+	response::Value document { response::Type::Map };
+
+	try
+	{
+		document = payload.get();
+	}
+	catch (service::schema_exception& scx)
+	{
+		document = buildErrorDocument(scx.getErrors());
+	}
+	catch (const std::exception& ex)
+	{
+		std::ostringstream oss;
+
+		oss << "Caught exception delivering subscription payload: " << ex.what();
+		document = buildErrorDocument(response::Value { oss.str() });
+	}
+
+	return document;
+}
+
+// Resolve the operation on the current thread and record how long it took.
+response::Value resolveDocument(ServiceMetrics& metrics, std::string_view operationType,
+	service::Request& service, service::RequestResolveParams&& params)
+{
+	const auto start = LatencyHistogram::Clock::now();
+	auto document = awaitDocument(service.resolve(std::move(params)));
+
+	metrics.Record(ServiceMetrics::Stage::Execute,
+		operationType,
+		LatencyHistogram::Clock::now() - start);
+
+	return document;
+}
+
+// Collects the results of the root selections of a query which were resolved separately, and
+// delivers each of them as soon as it's ready. The first one to finish becomes the initial
+// payload, and the rest follow as incremental patches at the root of the response:
+//   { "data": { ... }, "hasNext": true }
+//   { "incremental": [ { "data": { ... }, "path": [] } ], "hasNext": false }
+class IncrementalDelivery
+{
+public:
+	explicit IncrementalDelivery(
+		std::shared_ptr<SubscriptionPayloadQueue> payloadQueue, size_t partCount)
+		: _payloadQueue { std::move(payloadQueue) }
+		, _remaining { partCount }
+	{
+	}
+
+	// Called on whichever thread resolved the part. Holding the lock until the payload is on the
+	// PayloadChannel keeps the initial payload ahead of the patches, and the last one ahead of
+	// Complete.
+	void Deliver(response::Value&& document)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		const bool initial = !_delivered;
+		const bool hasNext = --_remaining > 0;
+
+		_delivered = true;
+
+		if (initial)
+		{
+			document.emplace_back(std::string { strHasNext }, response::Value { hasNext });
+			_payloadQueue->Push(std::move(document));
+		}
+		else
+		{
+			auto members = document.release<response::MapType>();
+			response::Value patch { response::Type::Map };
+			response::Value incremental { response::Type::List };
+			response::Value payload { response::Type::Map };
+
+			patch.reserve(members.size() + 1);
+
+			for (auto& member : members)
+			{
+				// A part which failed entirely only has errors, leave out the null data so it
+				// doesn't look like a patch for the whole response.
+				if (member.first == service::strData
+					&& member.second.type() == response::Type::Null)
+				{
+					continue;
+				}
+
+				patch.emplace_back(std::move(member.first), std::move(member.second));
+			}
+
+			patch.emplace_back(std::string { strPath }, response::Value { response::Type::List });
+			incremental.emplace_back(std::move(patch));
+			payload.reserve(2);
+			payload.emplace_back(std::string { strIncremental }, std::move(incremental));
+			payload.emplace_back(std::string { strHasNext }, response::Value { hasNext });
+			_payloadQueue->Push(std::move(payload));
+		}
+
+		if (!hasNext)
+		{
+			_payloadQueue->Complete();
+		}
+	}
+
+private:
+	static constexpr std::string_view strHasNext = "hasNext";
+	static constexpr std::string_view strIncremental = "incremental";
+	static constexpr std::string_view strPath = "path";
+
+	const std::shared_ptr<SubscriptionPayloadQueue> _payloadQueue;
+
+	std::mutex _mutex;
+	size_t _remaining;
+	bool _delivered = false;
+};
+
+// Per-request options passed in an optional object after the complete callback.
+struct FetchOptions
+{
+	PayloadOutput output = PayloadOutput::String;
+
+	// Resolve each root selection of a query separately, and deliver them as they finish.
+	bool incremental = false;
+
+	// Wait for mutations to deliver their change events to subscriptions before completing.
+	bool awaitDelivery = false;
+
+	// Add timings for each stage and resolver of a query or mutation to extensions.tracing.
+	bool tracing = false;
+
+	// Bound the number of undelivered subscription payloads, 0 for no limit.
+	size_t capacity = 0;
+	OverflowPolicy overflow = OverflowPolicy::DropOldest;
+};
+
+FetchOptions getFetchOptions(Local<Value> value)
+{
+	FetchOptions result;
+
+	if (!value->IsObject())
+	{
+		return result;
+	}
+
+	auto options = To<Object>(value).ToLocalChecked();
+	auto output = Nan::Get(options, New<String>("output").ToLocalChecked()).ToLocalChecked();
+
+	if (output->IsString())
+	{
+		const std::string outputName { *Nan::Utf8String(output) };
+
+		if (outputName == "external")
+		{
+			result.output = PayloadOutput::External;
+		}
+		else if (outputName == "object")
+		{
+			result.output = PayloadOutput::Object;
+		}
+		else if (outputName != "string")
+		{
+			throw std::invalid_argument("Unknown output option");
+		}
+	}
+
+	auto incremental =
+		Nan::Get(options, New<String>("incremental").ToLocalChecked()).ToLocalChecked();
+
+	result.incremental = incremental->IsTrue();
+
+	auto awaitDelivery =
+		Nan::Get(options, New<String>("awaitDelivery").ToLocalChecked()).ToLocalChecked();
+
+	result.awaitDelivery = awaitDelivery->IsTrue();
+
+	auto tracing = Nan::Get(options, New<String>("tracing").ToLocalChecked()).ToLocalChecked();
+
+	result.tracing = tracing->IsTrue();
+
+	auto capacity = Nan::Get(options, New<String>("capacity").ToLocalChecked()).ToLocalChecked();
+
+	if (!capacity->IsUndefined())
+	{
+		result.capacity = getSizeValue(capacity, "capacity", MaxSafeSize);
+	}
+
+	auto overflow = Nan::Get(options, New<String>("overflow").ToLocalChecked()).ToLocalChecked();
+
+	if (overflow->IsString())
+	{
+		const std::string overflowName { *Nan::Utf8String(overflow) };
+
+		if (overflowName == "latestWins")
+		{
+			result.overflow = OverflowPolicy::LatestWins;
+		}
+		else if (overflowName == "block")
+		{
+			result.overflow = OverflowPolicy::Block;
+		}
+		else if (overflowName != "dropOldest")
+		{
+			throw std::invalid_argument("Unknown overflow option");
+		}
+	}
+
+	return result;
+}
+
+// Variables arrive either as a JSON string or already converted from a JS object.
+using Variables = std::variant<std::string, response::Value>;
+
+response::Value parseVariables(Variables&& variables)
+{
+	if (auto json = std::get_if<std::string>(&variables))
+	{
+		return json->empty() ? response::Value(response::Type::Map) : response::parseJSON(*json);
+	}
+
+	return std::move(std::get<response::Value>(variables));
+}
+
+// Convert anything other than a string (or nothing at all) directly, which saves a JSON.stringify
+// in JS and parseJSON here.
+Variables getVariables(Local<Value> variables)
+{
+	if (variables->IsUndefined() || variables->IsNull())
+	{
+		return std::string {};
+	}
+
+	if (variables->IsString())
+	{
+		return std::string { *Nan::Utf8String(variables) };
+	}
+
+	return makeResponseValue(variables);
+}
+
+// The ids of the nodes a subscription is listening to with nodeChange. Returns an empty list if it
+// doesn't select nodeChange at all, or std::nullopt if it's not possible to tell in advance.
+std::optional<std::vector<response::IdType>> getNodeChangeIds(service::Request& service,
+	const QueryRegistry::Entry& query, std::string_view operationName,
+	const response::Value& variables)
+{
+	const auto arguments =
+		query.FindRootArguments(service, operationName, strNodeChange, "id", variables);
+
+	if (!arguments)
+	{
+		return std::nullopt;
+	}
+
+	std::vector<response::IdType> ids;
+
+	ids.reserve(arguments->size());
+
+	for (const auto& argument : *arguments)
+	{
+		auto id = SubscriptionIndex::ToId(argument);
+
+		if (!id)
+		{
+			return std::nullopt;
+		}
+
+		ids.push_back(std::move(*id));
+	}
+
+	return std::make_optional(std::move(ids));
+}
+
+// Every Expensive object counts the instances created so far, so its results are never the same
+// twice.
+bool isCacheable(const QueryRegistry::Entry::Operation& operation)
+{
+	return !operation.rootFields.empty()
+		&& std::find(operation.rootFields.cbegin(), operation.rootFields.cend(), "expensive")
+		== operation.rootFields.cend();
+}
+
+class RegisteredSubscription : public PayloadChannel::Receiver
+{
+public:
+	explicit RegisteredSubscription(ServiceInstance& instance, std::int32_t queryId,
+		std::string&& operationName, Variables&& variables, std::unique_ptr<Callback>&& next,
+		std::unique_ptr<Callback>&& complete, FetchOptions&& options)
+		: _instance { instance }
+		, _asyncResource { "graphql:subscription" }
+		, _next { std::move(next) }
+		, _complete { std::move(complete) }
+		, _options { std::move(options) }
+		, _payloadQueue { std::make_shared<SubscriptionPayloadQueue>(instance) }
+	{
+		_instance.payloadChannel->Acquire(this);
+		_payloadQueue->receiver = this;
+		_payloadQueue->output = _options.output;
+		_payloadQueue->capacity = _options.capacity;
+		_payloadQueue->overflow = _options.overflow;
+
+		try
+		{
+			const auto query = _instance.queryRegistry.Find(queryId);
+
+			if (!query)
+			{
+				throw std::runtime_error("Unknown queryId");
+			}
+
+			// Copy the AST so it shares the parsed tree, but survives a call to discardQuery
+			// while the ResolverExecutor is still working on it.
+			auto ast = query->ast;
+			auto tracer = _options.tracing ? std::make_shared<RequestTracer>() : nullptr;
+
+			if (tracer)
+			{
+				tracer->BeginStage(RequestTracer::Stage::Parsing);
+			}
+
+			auto parsedVariables = parseVariables(std::move(variables));
+
+			if (parsedVariables.type() != response::Type::Map)
+			{
+				throw std::runtime_error("Invalid variables object");
+			}
+
+			if (tracer)
+			{
+				tracer->EndStage(RequestTracer::Stage::Parsing);
+				tracer->BeginStage(RequestTracer::Stage::Validation);
+			}
+
+			const auto operation = query->FindOperation(*_instance.service, operationName);
+
+			_payloadQueue->operationType = operation.type;
+
+			if (tracer)
+			{
+				tracer->EndStage(RequestTracer::Stage::Validation);
+			}
+
+			if (operation.type == service::strSubscription)
+			{
+				// Bounded and conflating subscriptions need to see every pending payload, so
+				// only unbounded ones get the lock-free ring.
+				if (_options.capacity == 0 && _options.overflow != OverflowPolicy::LatestWins)
+				{
+					_payloadQueue->ring = std::make_unique<MpscRing<response::Value>>(
+						SubscriptionPayloadQueue::RingCapacity);
+				}
+
+				// Work out which nodes this subscription is listening to before the variables are
+				// moved into subscribe.
+				auto nodeIds =
+					getNodeChangeIds(*_instance.service, *query, operationName, parsedVariables);
+				SubscriptionIndex::Pending pending { _instance.subscriptionIndex, strNodeChange };
+				std::unique_lock<std::mutex> lock(_payloadQueue->mutex);
+
+				_payloadQueue->registered = true;
+				_payloadQueue->key = std::make_optional(
+					_instance.service
+						->subscribe(
+							{ [spQueue = _payloadQueue](response::Value payload) noexcept -> void {
+								 spQueue->Deliver(std::move(payload));
+							 },
+								std::move(ast),
+								std::move(operationName),
+								std::move(parsedVariables) })
+						.get());
+
+				if (!nodeIds)
+				{
+					_instance.subscriptionIndex.AddUnindexed(strNodeChange, *_payloadQueue->key);
+				}
+				else if (!nodeIds->empty())
+				{
+					_instance.subscriptionIndex.Add(strNodeChange,
+						std::move(*nodeIds),
+						*_payloadQueue->key);
+				}
+			}
+			else if (tracer)
+			{
+				// Skip the caches and incremental delivery, so the timings are for resolving
+				// the whole operation.
+				_payloadQueue->tracer = tracer;
+				ResolveTraced(std::move(tracer),
+					std::move(ast),
+					std::move(operationName),
+					std::move(parsedVariables));
+			}
+			else if (operation.introspection)
+			{
+				ResolveIntrospection(*query,
+					std::move(ast),
+					std::move(operationName),
+					std::move(parsedVariables));
+			}
+			else if (_options.incremental
+				&& ResolveIncrementally(*query, operationName, parsedVariables))
+			{
+				// Each root selection delivers its own payload.
+			}
+			else if (_instance.responseCache && operation.type == service::strQuery
+				&& isCacheable(operation))
+			{
+				ResolveCached(*query,
+					std::move(ast),
+					std::move(operationName),
+					std::move(parsedVariables));
+			}
+			else if (!_instance.resolverExecutor->Post([&metrics = _instance.metrics,
+						 spQueue = _payloadQueue,
+						 service = _instance.service,
+						 ast = std::move(ast),
+						 operationName = std::move(operationName),
+						 parsedVariables = std::move(parsedVariables),
+						 state = std::make_shared<FetchState>(
+							 _options.awaitDelivery)]() mutable {
+						 spQueue->Push(resolveDocument(metrics,
+							 spQueue->operationType,
+							 *service,
+							 { ast,
+								 operationName,
+								 std::move(parsedVariables),
+								 {},
+								 std::move(state) }));
+						 spQueue->Complete();
+					 }))
+			{
+				_payloadQueue->Push(buildErrorDocument(
+					response::Value { std::string { "Resolver queue is full" } }));
+				_payloadQueue->Complete();
+			}
+		}
+		catch (service::schema_exception& scx)
+		{
+			_payloadQueue->Push(buildErrorDocument(scx.getErrors()));
+			_payloadQueue->Complete();
+		}
+		catch (const std::exception& ex)
+		{
+			std::ostringstream oss;
+
+			oss << "Caught exception preparing the request: " << ex.what();
+			_payloadQueue->Push(buildErrorDocument(response::Value { oss.str() }));
+			_payloadQueue->Complete();
+		}
+	}
+
+	~RegisteredSubscription() override
+	{
+		_payloadQueue->Unsubscribe();
+		_instance.payloadChannel->Release(this);
+	}
+
+	const std::shared_ptr<SubscriptionPayloadQueue>& GetPayloadQueue() const
+	{
+		return _payloadQueue;
+	}
+
+private:
+	void ResolveTraced(std::shared_ptr<RequestTracer>&& tracer, peg::ast&& ast,
+		std::string&& operationName, response::Value&& variables)
+	{
+		if (!_instance.resolverExecutor->Post([&metrics = _instance.metrics,
+				spQueue = _payloadQueue,
+				service = _instance.service,
+				ast = std::move(ast),
+				operationName = std::move(operationName),
+				variables = std::move(variables),
+				state = std::make_shared<FetchState>(_options.awaitDelivery,
+					false,
+					std::move(tracer))]() mutable {
+				state->tracer->BeginStage(RequestTracer::Stage::Execution);
+
+				auto document = resolveDocument(metrics,
+					spQueue->operationType,
+					*service,
+					{ ast, operationName, std::move(variables), {}, state });
+
+				state->tracer->EndStage(RequestTracer::Stage::Execution);
+				spQueue->Push(std::move(document));
+				spQueue->Complete();
+			}))
+		{
+			_payloadQueue->Push(buildErrorDocument(
+				response::Value { std::string { "Resolver queue is full" } }));
+			_payloadQueue->Complete();
+		}
+	}
+
+	// Deliver the result from the IntrospectionCache if it's there, and otherwise resolve it and
+	// add it to the cache.
+	void ResolveIntrospection(const QueryRegistry::Entry& query, peg::ast&& ast,
+		std::string&& operationName, response::Value&& variables)
+	{
+		auto key = IntrospectionCache::MakeKey(*getSchema(), query, operationName, variables);
+
+		if (const auto result = _instance.introspectionCache.Find(key))
+		{
+			_payloadQueue->PushCached(*result);
+			_payloadQueue->Complete();
+			return;
+		}
+
+		if (!_instance.resolverExecutor->Post([&cache = _instance.introspectionCache,
+				&metrics = _instance.metrics,
+				spQueue = _payloadQueue,
+				service = _instance.service,
+				key = std::move(key),
+				ast = std::move(ast),
+				operationName = std::move(operationName),
+				variables = std::move(variables)]() mutable {
+				const auto result = cache.Insert(std::move(key),
+					resolveDocument(metrics,
+						spQueue->operationType,
+						*service,
+						{ ast, operationName, std::move(variables) }));
+
+				spQueue->PushCached(*result);
+				spQueue->Complete();
+			}))
+		{
+			_payloadQueue->Push(buildErrorDocument(
+				response::Value { std::string { "Resolver queue is full" } }));
+			_payloadQueue->Complete();
+		}
+	}
+
+	// Deliver the result from the ResponseCache if it's there, and otherwise resolve it and add it
+	// to the cache, tagged with the nodes it resolved.
+	void ResolveCached(const QueryRegistry::Entry& query, peg::ast&& ast,
+		std::string&& operationName, response::Value&& variables)
+	{
+		auto& cache = *_instance.responseCache;
+		auto key = ResponseCache::MakeKey(query, operationName, variables);
+		std::uint64_t generation = 0;
+
+		if (const auto result = cache.Find(key, query.normalized, generation))
+		{
+			_payloadQueue->PushCached(*result);
+			_payloadQueue->Complete();
+			return;
+		}
+
+		if (!_instance.resolverExecutor->Post([&cache,
+				&metrics = _instance.metrics,
+				spQueue = _payloadQueue,
+				service = _instance.service,
+				key = std::move(key),
+				normalized = query.normalized,
+				generation,
+				ast = std::move(ast),
+				operationName = std::move(operationName),
+				variables = std::move(variables),
+				state = std::make_shared<FetchState>(_options.awaitDelivery, true)]() mutable {
+				auto document = resolveDocument(metrics,
+					spQueue->operationType,
+					*service,
+					{ ast, operationName, std::move(variables), {}, state });
+
+				spQueue->PushCached(*cache.Insert(std::move(key),
+					normalized,
+					generation,
+					std::move(document),
+					std::move(state->nodeIds)));
+				spQueue->Complete();
+			}))
+		{
+			_payloadQueue->Push(buildErrorDocument(
+				response::Value { std::string { "Resolver queue is full" } }));
+			_payloadQueue->Complete();
+		}
+	}
+
+	// Returns false if the operation can't be split, in which case it's resolved as a whole. That
+	// includes a part which fails validation on its own, so the whole operation reports it.
+	bool ResolveIncrementally(const QueryRegistry::Entry& query, const std::string& operationName,
+		const response::Value& variables)
+	{
+		std::shared_ptr<const QueryRegistry::Entry::RootParts> parts;
+
+		try
+		{
+			parts = query.SplitRootSelections(*_instance.service, operationName);
+		}
+		catch (const std::exception&)
+		{
+			return false;
+		}
+
+		if (parts->empty())
+		{
+			return false;
+		}
+
+		auto delivery = std::make_shared<IncrementalDelivery>(_payloadQueue, parts->size());
+
+		for (const auto& part : *parts)
+		{
+			if (!_instance.resolverExecutor->Post([&metrics = _instance.metrics,
+					delivery,
+					service = _instance.service,
+					ast = part,
+					operationName,
+					parsedVariables = response::Value { variables }]() mutable {
+					response::Value document;
+
+					// Every part has to be delivered, or the last one never completes the request.
+					try
+					{
+						document = resolveDocument(metrics,
+							service::strQuery,
+							*service,
+							{ ast, operationName, std::move(parsedVariables) });
+					}
+					catch (const std::exception& ex)
+					{
+						std::ostringstream oss;
+
+						oss << "Caught exception resolving a root selection: " << ex.what();
+						document = buildErrorDocument(response::Value { oss.str() });
+					}
+
+					delivery->Deliver(std::move(document));
+				}))
+			{
+				delivery->Deliver(buildErrorDocument(
+					response::Value { std::string { "Resolver queue is full" } }));
+			}
+		}
+
+		return true;
+	}
+
+	// Executed on the main event loop by the PayloadChannel,
+	// so it is safe to use V8 again.
+	void OnPayload(PayloadChannel::Payload&& payload) override
+	{
+		if (const auto& tracer = _payloadQueue->tracer)
+		{
+			tracer->EndStage(RequestTracer::Stage::Delivery);
+			std::visit(
+				[&tracer](auto& value) {
+					tracer->AddTo(value);
+				},
+				payload);
+		}
+
+		HandleScope scope;
+		Local<Value> argv[] = {
+			makeJSPayload(std::move(payload), _options.output, *_instance.fieldNameCache)
+		};
+
+		_payloadQueue->Acknowledge();
+		_next->Call(1, argv, &_asyncResource);
+	}
+
+	void OnComplete() override
+	{
+		{
+			HandleScope scope;
+
+			_complete->Call(0, nullptr, &_asyncResource);
+		}
+
+		delete this;
+	}
+
+	ServiceInstance& _instance;
+	Nan::AsyncResource _asyncResource;
+	std::unique_ptr<Callback> _next;
+	std::unique_ptr<Callback> _complete;
+	const FetchOptions _options;
+	std::shared_ptr<SubscriptionPayloadQueue> _payloadQueue;
+};
+
+NAN_METHOD(fetchQuery)
+{
+	auto& instance = getInstance(info);
+	const auto queryId = To<std::int32_t>(info[0]).FromJust();
+	std::string operationName(*Nan::Utf8String(To<String>(info[1]).ToLocalChecked()));
+	auto next = std::make_unique<Callback>(To<Function>(info[3]).ToLocalChecked());
+	auto complete = std::make_unique<Callback>(To<Function>(info[4]).ToLocalChecked());
+	Variables variables;
+	FetchOptions options;
+
+	try
+	{
+		variables = getVariables(info[2]);
+		options = getFetchOptions(info[5]);
+	}
+	catch (const std::exception& ex)
+	{
+		Nan::ThrowError(ex.what());
+		return;
+	}
+
+	auto subscription = std::make_unique<RegisteredSubscription>(instance,
+		queryId,
 		std::move(operationName),
-		variables,
+		std::move(variables),
 		std::move(next),
-		std::move(complete));
+		std::move(complete),
+		std::move(options));
+
+	instance.subscriptionMap[queryId] = subscription->GetPayloadQueue();
 
-	subscriptionMap[queryId] = subscription->GetPayloadQueue();
-	AsyncQueueWorker(subscription.release());
+	// The subscription deletes itself on the main thread after calling complete.
+	subscription.release();
 }
 
 NAN_METHOD(unsubscribe)
 {
+	auto& subscriptionMap = getInstance(info).subscriptionMap;
 	const auto queryId = To<std::int32_t>(info[0]).FromJust();
 	auto itr = subscriptionMap.find(queryId);
 
@@ -432,14 +1838,316 @@ NAN_METHOD(unsubscribe)
 	}
 }
 
+NAN_METHOD(getSubscriptionStats)
+{
+	const auto& instance = getInstance(info);
+	auto stats = New<Object>();
+
+	Set(stats,
+		New<String>("dropped").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(instance.droppedPayloads.load())));
+	Set(stats,
+		New<String>("conflated").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(instance.conflatedPayloads.load())));
+
+	info.GetReturnValue().Set(stats);
+}
+
+// Sampled every time getMetrics is called, in the same order for the JS object and the text.
+struct MetricsSample
+{
+	size_t subscriptions = 0;
+
+	// Pending, in flight and still in the ring for each open subscription, by queryId.
+	std::vector<std::pair<std::int32_t, size_t>> queuedPayloads;
+
+	struct Executor
+	{
+		std::string_view name;
+		size_t threads = 0;
+		size_t queued = 0;
+		size_t active = 0;
+	};
+
+	std::array<Executor, 3> executors {};
+};
+
+MetricsSample sampleMetrics(const ServiceInstance& instance)
+{
+	MetricsSample sample;
+
+	for (const auto& [queryId, queue] : instance.subscriptionMap)
+	{
+		std::lock_guard<std::mutex> lock(queue->mutex);
+
+		if (!queue->registered)
+		{
+			continue;
+		}
+
+		++sample.subscriptions;
+		sample.queuedPayloads.emplace_back(queryId,
+			queue->pending.size() + queue->inFlight + (queue->ring ? queue->ring->Size() : 0));
+	}
+
+	const auto sampleExecutor = [](std::string_view name, const ResolverExecutor* executor) {
+		return MetricsSample::Executor { name,
+			executor ? executor->ThreadCount() : 0,
+			executor ? executor->QueuedCount() : 0,
+			executor ? executor->ActiveCount() : 0 };
+	};
+
+	sample.executors[0] = sampleExecutor("resolver", instance.resolverExecutor.get());
+	sample.executors[1] = sampleExecutor("delivery", instance.deliveryExecutor.get());
+	sample.executors[2] = MetricsSample::Executor { "dispatcher",
+		instance.subscriptionDispatcher ? instance.subscriptionDispatcher->ThreadCount() : 0 };
+
+	return sample;
+}
+
+std::vector<ServiceMetrics::Gauge> getMetricsGauges(const MetricsSample& sample)
+{
+	std::vector<ServiceMetrics::Gauge> gauges;
+
+	gauges.push_back({ "cppgraphql_subscriptions",
+		"Number of open subscriptions.",
+		{},
+		static_cast<double>(sample.subscriptions) });
+
+	for (const auto& [queryId, queued] : sample.queuedPayloads)
+	{
+		gauges.push_back({ "cppgraphql_subscription_queued_payloads",
+			"Payloads waiting to be passed to the next callback of a subscription.",
+			"query_id=\"" + std::to_string(queryId) + '"',
+			static_cast<double>(queued) });
+	}
+
+	for (const auto& executor : sample.executors)
+	{
+		gauges.push_back({ "cppgraphql_executor_threads",
+			"Number of threads in each pool.",
+			"executor=\"" + std::string { executor.name } + '"',
+			static_cast<double>(executor.threads) });
+	}
+
+	// The dispatcher doesn't have a task queue.
+	for (size_t i = 0; i < 2; ++i)
+	{
+		gauges.push_back({ "cppgraphql_executor_queued_tasks",
+			"Tasks waiting for a thread in each pool.",
+			"executor=\"" + std::string { sample.executors[i].name } + '"',
+			static_cast<double>(sample.executors[i].queued) });
+	}
+
+	for (size_t i = 0; i < 2; ++i)
+	{
+		gauges.push_back({ "cppgraphql_executor_active_threads",
+			"Threads which are running a task in each pool.",
+			"executor=\"" + std::string { sample.executors[i].name } + '"',
+			static_cast<double>(sample.executors[i].active) });
+	}
+
+	return gauges;
+}
+
+Local<Object> makeLatencyObject(const LatencyHistogram& histogram)
+{
+	constexpr double nanosecondsPerMillisecond = 1e6;
+	const auto snapshot = histogram.Read();
+	auto result = New<Object>();
+	const auto setMilliseconds = [&result](const char* name, double nanoseconds) {
+		Set(result,
+			New<String>(name).ToLocalChecked(),
+			New<v8::Number>(nanoseconds / nanosecondsPerMillisecond));
+	};
+
+	Set(result,
+		New<String>("count").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(snapshot.count)));
+	setMilliseconds("mean",
+		snapshot.count > 0
+			? static_cast<double>(snapshot.sum) / static_cast<double>(snapshot.count)
+			: 0.0);
+	setMilliseconds("p50", static_cast<double>(snapshot.Percentile(50.0)));
+	setMilliseconds("p90", static_cast<double>(snapshot.Percentile(90.0)));
+	setMilliseconds("p99", static_cast<double>(snapshot.Percentile(99.0)));
+	setMilliseconds("p999", static_cast<double>(snapshot.Percentile(99.9)));
+	setMilliseconds("max", static_cast<double>(snapshot.max));
+
+	return result;
+}
+
+// Returns the metrics as a JS object, or as Prometheus text if the first argument is "text".
+NAN_METHOD(getMetrics)
+{
+	const auto& instance = getInstance(info);
+	const auto sample = sampleMetrics(instance);
+
+	if (info.Length() > 0 && info[0]->IsString()
+		&& std::string_view { *Nan::Utf8String(info[0]) } == "text")
+	{
+		info.GetReturnValue().Set(
+			New<String>(instance.metrics.FormatText(getMetricsGauges(sample))).ToLocalChecked());
+		return;
+	}
+
+	auto metrics = New<Object>();
+	auto stages = New<Object>();
+
+	for (size_t stage = 0; stage < ServiceMetrics::StageNames.size(); ++stage)
+	{
+		auto operations = New<Object>();
+
+		for (size_t operation = 0; operation < ServiceMetrics::OperationNames.size(); ++operation)
+		{
+			Set(operations,
+				New<String>(ServiceMetrics::OperationNames[operation].data(),
+					static_cast<int>(ServiceMetrics::OperationNames[operation].size()))
+					.ToLocalChecked(),
+				makeLatencyObject(instance.metrics.Histogram(
+					static_cast<ServiceMetrics::Stage>(stage), operation)));
+		}
+
+		Set(stages,
+			New<String>(ServiceMetrics::StageNames[stage].data(),
+				static_cast<int>(ServiceMetrics::StageNames[stage].size()))
+				.ToLocalChecked(),
+			operations);
+	}
+
+	auto queuedPayloads = New<Object>();
+
+	for (const auto& [queryId, queued] : sample.queuedPayloads)
+	{
+		Set(queuedPayloads,
+			New<String>(std::to_string(queryId)).ToLocalChecked(),
+			New<v8::Number>(static_cast<double>(queued)));
+	}
+
+	auto executors = New<Object>();
+
+	for (const auto& executor : sample.executors)
+	{
+		auto counts = New<Object>();
+
+		Set(counts,
+			New<String>("threads").ToLocalChecked(),
+			New<v8::Number>(static_cast<double>(executor.threads)));
+		Set(counts,
+			New<String>("queued").ToLocalChecked(),
+			New<v8::Number>(static_cast<double>(executor.queued)));
+		Set(counts,
+			New<String>("active").ToLocalChecked(),
+			New<v8::Number>(static_cast<double>(executor.active)));
+		Set(executors,
+			New<String>(executor.name.data(), static_cast<int>(executor.name.size()))
+				.ToLocalChecked(),
+			counts);
+	}
+
+	Set(metrics, New<String>("stages").ToLocalChecked(), stages);
+	Set(metrics,
+		New<String>("deliveryLag").ToLocalChecked(),
+		makeLatencyObject(instance.metrics.deliveryLag));
+	Set(metrics,
+		New<String>("subscriptions").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(sample.subscriptions)));
+	Set(metrics, New<String>("queuedPayloads").ToLocalChecked(), queuedPayloads);
+	Set(metrics,
+		New<String>("droppedPayloads").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(instance.droppedPayloads.load())));
+	Set(metrics,
+		New<String>("conflatedPayloads").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(instance.conflatedPayloads.load())));
+	Set(metrics, New<String>("executors").ToLocalChecked(), executors);
+
+	info.GetReturnValue().Set(metrics);
+}
+
+void exportMethod(
+	Local<Object> target, const char* name, Nan::FunctionCallback method, Local<Value> data)
+{
+	Set(target,
+		New<String>(name).ToLocalChecked(),
+		GetFunction(New<FunctionTemplate>(method, data)).ToLocalChecked());
+}
+
+NAN_METHOD(getResponseCacheStats)
+{
+	const auto& responseCache = getInstance(info).responseCache;
+	const auto cacheStats = responseCache ? responseCache->GetStats() : ResponseCache::Stats {};
+	auto stats = New<Object>();
+
+	Set(stats,
+		New<String>("hits").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(cacheStats.hits)));
+	Set(stats,
+		New<String>("misses").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(cacheStats.misses)));
+	Set(stats,
+		New<String>("evictions").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(cacheStats.evictions)));
+	Set(stats,
+		New<String>("invalidations").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(cacheStats.invalidations)));
+	Set(stats,
+		New<String>("entries").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(cacheStats.entries)));
+	Set(stats,
+		New<String>("bytes").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(cacheStats.bytes)));
+
+	info.GetReturnValue().Set(stats);
+}
+
+NAN_METHOD(getIntrospectionCacheStats)
+{
+	const auto cacheStats = getInstance(info).introspectionCache.GetStats();
+	auto stats = New<Object>();
+
+	Set(stats,
+		New<String>("hits").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(cacheStats.hits)));
+	Set(stats,
+		New<String>("misses").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(cacheStats.misses)));
+	Set(stats,
+		New<String>("entries").ToLocalChecked(),
+		New<v8::Number>(static_cast<double>(cacheStats.entries)));
+
+	info.GetReturnValue().Set(stats);
+}
+
 NAN_MODULE_INIT(Init)
 {
-	NAN_EXPORT(target, startService);
-	NAN_EXPORT(target, stopService);
-	NAN_EXPORT(target, parseQuery);
-	NAN_EXPORT(target, discardQuery);
-	NAN_EXPORT(target, fetchQuery);
-	NAN_EXPORT(target, unsubscribe);
+	preloadSchema();
+	detectExternalBuffers();
+
+	auto instance = new ServiceInstance(Nan::GetCurrentEventLoop());
+	auto data = New<v8::External>(instance);
+
+	// Stop the service and release everything when the environment goes away, e.g. when a
+	// worker_thread exits.
+	node::AddEnvironmentCleanupHook(
+		v8::Isolate::GetCurrent(),
+		[](void* arg) {
+			delete static_cast<ServiceInstance*>(arg);
+		},
+		instance);
+
+	exportMethod(target, "startService", startService, data);
+	exportMethod(target, "stopService", stopService, data);
+	exportMethod(target, "parseQuery", parseQuery, data);
+	exportMethod(target, "parseQueryAsync", parseQueryAsync, data);
+	exportMethod(target, "parsePersistedQuery", parsePersistedQuery, data);
+	exportMethod(target, "getQueryHash", getQueryHash, data);
+	exportMethod(target, "discardQuery", discardQuery, data);
+	exportMethod(target, "fetchQuery", fetchQuery, data);
+	exportMethod(target, "unsubscribe", unsubscribe, data);
+	exportMethod(target, "getSubscriptionStats", getSubscriptionStats, data);
+	exportMethod(target, "getResponseCacheStats", getResponseCacheStats, data);
+	exportMethod(target, "getIntrospectionCacheStats", getIntrospectionCacheStats, data);
+	exportMethod(target, "getMetrics", getMetrics, data);
 }
 
-NODE_MODULE(cppgraphql, Init)
\ No newline at end of file
+NAN_MODULE_WORKER_ENABLED(cppgraphql, Init)
@@ -0,0 +1,122 @@
+#include "NodeIndex.h"
+
+using namespace graphql;
+
+NodeIndex::NodeIndex()
+	: _table { new Table(MinCapacity) }
+{
+}
+
+NodeIndex::~NodeIndex()
+{
+	delete _table.load();
+}
+
+void NodeIndex::Insert(
+	response::IdType id, NodeType type, std::shared_ptr<today::object::Node> node)
+{
+	std::lock_guard<std::mutex> lock(_writeMutex);
+	const auto current = _table.load(std::memory_order_relaxed);
+	auto capacity = current->slots.size();
+
+	while ((current->count + 1) * 2 > capacity)
+	{
+		capacity *= 2;
+	}
+
+	// Rehash into the copy, the current table stays untouched for the readers which are probing it.
+	auto next = std::make_unique<Table>(capacity);
+
+	for (const auto& slot : current->slots)
+	{
+		if (slot.occupied)
+		{
+			auto& copy = next->ProbeForInsert(slot.hash, slot.id);
+
+			copy = slot;
+			++next->count;
+		}
+	}
+
+	if (auto normalized = today::NormalizeId(id))
+	{
+		id = std::move(*normalized);
+	}
+
+	const auto hash = today::HashId(id);
+	auto& slot = next->ProbeForInsert(hash, id);
+
+	if (!slot.occupied)
+	{
+		slot.hash = hash;
+		slot.id = std::move(id);
+		slot.occupied = true;
+		++next->count;
+	}
+
+	slot.entry = Entry { type, std::move(node) };
+
+	_table.store(next.release(), std::memory_order_release);
+	_retired.emplace_back(current);
+}
+
+const NodeIndex::Entry* NodeIndex::Find(const response::IdType& id) const
+{
+	const auto table = _table.load(std::memory_order_acquire);
+	const auto normalized = today::NormalizeId(id);
+	const auto& key = normalized ? *normalized : id;
+	const auto slot = table->Probe(today::HashId(key), key);
+
+	return slot ? &slot->entry : nullptr;
+}
+
+void NodeIndex::Reclaim()
+{
+	std::lock_guard<std::mutex> lock(_writeMutex);
+
+	_retired.clear();
+}
+
+size_t NodeIndex::size() const noexcept
+{
+	return _table.load(std::memory_order_acquire)->count;
+}
+
+NodeIndex::Table::Table(size_t capacity)
+	: mask { capacity - 1 }
+	, slots(capacity)
+{
+}
+
+const NodeIndex::Slot* NodeIndex::Table::Probe(
+	size_t hash, const response::IdType& id) const noexcept
+{
+	for (auto index = hash & mask;; index = (index + 1) & mask)
+	{
+		const auto& slot = slots[index];
+
+		if (!slot.occupied)
+		{
+			return nullptr;
+		}
+
+		if (slot.hash == hash && slot.id == id)
+		{
+			return &slot;
+		}
+	}
+}
+
+NodeIndex::Slot& NodeIndex::Table::ProbeForInsert(
+	size_t hash, const response::IdType& id) noexcept
+{
+	for (auto index = hash & mask;; index = (index + 1) & mask)
+	{
+		auto& slot = slots[index];
+
+		if (!slot.occupied || (slot.hash == hash && slot.id == id))
+		{
+			return slot;
+		}
+	}
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#ifndef NODEINDEX_H
+#define NODEINDEX_H
+
+#include "TodayMock.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Flat hash index from id to the node a service delivers change events for. Each entry is tagged
+// with the type of the node, so a lookup answers both "does it exist" and "what is it" in one
+// probe sequence. The service's today::Query asks it for the type of each node(id:), so it only
+// loads the list which owns the id.
+//
+// Lookups happen on the resolver and delivery threads for every mutation and change event, and
+// they never take a lock. A write copies the current table, changes the copy and publishes it with
+// a single atomic store (read-copy-update). The table it replaced is retired rather than deleted,
+// because a reader may still be probing it, and it's only reclaimed once the caller knows there
+// are no readers left, e.g. after the service's threads have been joined. Writes only happen when
+// the service starts, so the retired tables don't add up to much in between.
+class NodeIndex
+{
+public:
+	using NodeType = graphql::today::NodeType;
+
+	struct Entry
+	{
+		NodeType type;
+		std::shared_ptr<graphql::today::object::Node> node;
+	};
+
+	NodeIndex();
+	~NodeIndex();
+
+	NodeIndex(const NodeIndex&) = delete;
+	NodeIndex& operator=(const NodeIndex&) = delete;
+
+	// Only called on the thread which owns the service. Replaces any existing entry for the id.
+	// Each call copies and rehashes the whole table, so it's O(n). It's meant for the handful of
+	// nodes a service inserts when it starts, not for loading a large list.
+	void Insert(graphql::response::IdType id, NodeType type,
+		std::shared_ptr<graphql::today::object::Node> node);
+
+	// Called on any thread. The entry stays valid until the next call to Reclaim.
+	const Entry* Find(const graphql::response::IdType& id) const;
+
+	// Delete the retired tables. The caller guarantees that no other thread is in Find.
+	void Reclaim();
+
+	size_t size() const noexcept;
+
+private:
+	struct Slot
+	{
+		size_t hash = 0;
+		graphql::response::IdType id;
+		Entry entry {};
+		bool occupied = false;
+	};
+
+	struct Table
+	{
+		explicit Table(size_t capacity);
+
+		// Linear probing from the hash, it stops at the first slot which matches or is empty.
+		const Slot* Probe(size_t hash, const graphql::response::IdType& id) const noexcept;
+		Slot& ProbeForInsert(size_t hash, const graphql::response::IdType& id) noexcept;
+
+		const size_t mask;
+		std::vector<Slot> slots;
+		size_t count = 0;
+	};
+
+	// The capacity is always a power of 2, and Insert keeps at least half of the slots empty so
+	// the probe sequences stay short.
+	static constexpr size_t MinCapacity = 16;
+
+	std::atomic<const Table*> _table;
+
+	// Only touched by writers.
+	std::mutex _writeMutex;
+	std::vector<std::unique_ptr<const Table>> _retired;
+};
+
+#endif // NODEINDEX_H
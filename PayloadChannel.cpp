@@ -0,0 +1,100 @@
+#include "PayloadChannel.h"
+
+PayloadChannel::PayloadChannel(uv_loop_t* loop)
+{
+	uv_async_init(loop, &_wake, OnWake);
+	_wake.data = this;
+
+	// Don't hold the loop open until somebody is waiting for a payload.
+	uv_unref(reinterpret_cast<uv_handle_t*>(&_wake));
+}
+
+void PayloadChannel::Acquire(Receiver* receiver)
+{
+	if (_receivers.insert(receiver).second && _receivers.size() == 1)
+	{
+		uv_ref(reinterpret_cast<uv_handle_t*>(&_wake));
+	}
+}
+
+void PayloadChannel::Release(Receiver* receiver)
+{
+	if (_receivers.erase(receiver) != 0 && _receivers.empty())
+	{
+		uv_unref(reinterpret_cast<uv_handle_t*>(&_wake));
+	}
+}
+
+void PayloadChannel::Close()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_entries.clear();
+	}
+
+	// The receivers call Release from their destructors, so delete them from a copy.
+	const auto receivers = _receivers;
+
+	for (auto receiver : receivers)
+	{
+		delete receiver;
+	}
+
+	uv_close(reinterpret_cast<uv_handle_t*>(&_wake), [](uv_handle_t* handle) {
+		delete static_cast<PayloadChannel*>(handle->data);
+	});
+}
+
+void PayloadChannel::Send(Receiver* receiver, Payload&& payload)
+{
+	Push({ receiver, std::make_optional(std::move(payload)) });
+}
+
+void PayloadChannel::SendComplete(Receiver* receiver)
+{
+	Push({ receiver, std::nullopt });
+}
+
+void PayloadChannel::Push(Entry&& entry)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_entries.push_back(std::move(entry));
+
+	if (!_wakePending)
+	{
+		// Coalesce the wakeups, the main thread will pick up everything queued until it drains.
+		_wakePending = true;
+		uv_async_send(&_wake);
+	}
+}
+
+void PayloadChannel::OnWake(uv_async_t* handle)
+{
+	static_cast<PayloadChannel*>(handle->data)->Drain();
+}
+
+void PayloadChannel::Drain()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	// Swap the buffers so the producers can keep reusing the capacity we allocated last time.
+	_draining.swap(_entries);
+	_wakePending = false;
+	lock.unlock();
+
+	for (auto& entry : _draining)
+	{
+		if (entry.payload)
+		{
+			entry.receiver->OnPayload(std::move(*entry.payload));
+		}
+		else
+		{
+			entry.receiver->OnComplete();
+		}
+	}
+
+	_draining.clear();
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#ifndef PAYLOADCHANNEL_H
+#define PAYLOADCHANNEL_H
+
+#include "graphqlservice/GraphQLResponse.h"
+
+#include <uv.h>
+
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+// Single thread-safe hop from any producer thread to the event loop of the environment which loaded
+// the module, shared by every open request in that environment. It follows the same model as
+// napi_threadsafe_function: any thread may Send, and the loop thread calls back into each Receiver
+// in the order the payloads were sent. Payloads are moved in once and handed to the receiver by
+// rvalue, and a burst of Sends only wakes the loop once.
+class PayloadChannel
+{
+public:
+	// Either the serialized JSON, or the response document itself if the receiver is going to
+	// convert it directly to JS.
+	using Payload = std::variant<std::string, graphql::response::Value>;
+
+	class Receiver
+	{
+	public:
+		virtual ~Receiver() = default;
+
+		// Both are called on the main thread. OnComplete is always the last call for a receiver,
+		// so it may delete itself there.
+		virtual void OnPayload(Payload&& payload) = 0;
+		virtual void OnComplete() = 0;
+	};
+
+	explicit PayloadChannel(uv_loop_t* loop);
+
+	PayloadChannel(const PayloadChannel&) = delete;
+	PayloadChannel& operator=(const PayloadChannel&) = delete;
+
+	// Called on the main thread. The channel only keeps the event loop alive while at least one
+	// receiver is still waiting for OnComplete.
+	void Acquire(Receiver* receiver);
+	void Release(Receiver* receiver);
+
+	// Called on the main thread when the environment which owns the loop is shutting down, after
+	// every producer thread has been joined. Payloads which haven't been delivered are dropped,
+	// receivers which are still waiting for OnComplete are deleted, and the channel deletes itself
+	// once libuv is done with the handle.
+	void Close();
+
+	// Called on any thread.
+	void Send(Receiver* receiver, Payload&& payload);
+	void SendComplete(Receiver* receiver);
+
+private:
+	struct Entry
+	{
+		Receiver* receiver;
+
+		// Empty for the final OnComplete entry.
+		std::optional<Payload> payload;
+	};
+
+	~PayloadChannel() = default;
+
+	static void OnWake(uv_async_t* handle);
+
+	void Push(Entry&& entry);
+	void Drain();
+
+	uv_async_t _wake;
+
+	std::mutex _mutex;
+	std::vector<Entry> _entries;
+	bool _wakePending = false;
+
+	// Only used on the main thread.
+	std::vector<Entry> _draining;
+	std::unordered_set<Receiver*> _receivers;
+};
+
+#endif // PAYLOADCHANNEL_H
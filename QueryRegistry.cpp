@@ -0,0 +1,819 @@
+#include "QueryRegistry.h"
+
+#include "graphqlservice/internal/Grammar.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <set>
+#include <sstream>
+
+using namespace graphql;
+
+namespace {
+
+using FragmentDefinitions = std::map<std::string_view, const peg::ast_node*>;
+
+template <typename Match>
+const peg::ast_node* findChild(const peg::ast_node& node, Match&& match)
+{
+	const auto itr = std::find_if(node.children.cbegin(),
+		node.children.cend(),
+		[&match](const auto& child) noexcept {
+			return match(*child);
+		});
+
+	return itr == node.children.cend() ? nullptr : itr->get();
+}
+
+// Variable names show up with and without the leading $ depending on the rule.
+std::string_view variableName(std::string_view name) noexcept
+{
+	return (!name.empty() && name.front() == '$') ? name.substr(1) : name;
+}
+
+// Collect every variable and fragment which is referenced from this node, following fragment
+// spreads into the fragment definitions.
+void collectReferences(const peg::ast_node& node, const FragmentDefinitions& definitions,
+	std::set<std::string_view>& fragments, std::set<std::string_view>& variables)
+{
+	if (node.is_type<peg::variable_value>())
+	{
+		variables.insert(variableName(node.string_view()));
+		return;
+	}
+
+	if (node.is_type<peg::fragment_spread>())
+	{
+		const auto name = findChild(node, [](const peg::ast_node& child) noexcept {
+			return child.is_type<peg::fragment_name>();
+		});
+
+		if (name && fragments.insert(name->string_view()).second)
+		{
+			const auto itr = definitions.find(name->string_view());
+
+			if (itr != definitions.end())
+			{
+				collectReferences(*itr->second, definitions, fragments, variables);
+			}
+		}
+	}
+
+	for (const auto& child : node.children)
+	{
+		collectReferences(*child, definitions, fragments, variables);
+	}
+}
+
+// Walk the root selection set, descending into inline fragments and fragment spreads, and
+// append the argument values for every matching field. Returns false if one of them is missing
+// or isn't a string literal or a variable.
+bool collectRootArguments(const peg::ast_node& selectionSet, const FragmentDefinitions& definitions,
+	std::string_view fieldName, std::string_view argumentName, const response::Value& variables,
+	std::vector<response::Value>& values, std::set<std::string_view>& visited)
+{
+	for (const auto& selection : selectionSet.children)
+	{
+		if (selection->is_type<peg::field>())
+		{
+			const auto name = findChild(*selection, [](const peg::ast_node& child) noexcept {
+				return child.is_type<peg::field_name>();
+			});
+
+			if (!name || name->string_view() != fieldName)
+			{
+				continue;
+			}
+
+			const auto arguments = findChild(*selection, [](const peg::ast_node& child) noexcept {
+				return child.is_type<peg::arguments>();
+			});
+			const auto argument = arguments
+				? findChild(*arguments,
+					[argumentName](const peg::ast_node& child) {
+						const auto name = findChild(child, [](const peg::ast_node& node) noexcept {
+							return node.is_type<peg::argument_name>();
+						});
+
+						return name && name->string_view() == argumentName;
+					})
+				: nullptr;
+
+			if (!argument || argument->children.size() < 2)
+			{
+				return false;
+			}
+
+			const auto& value = *argument->children.back();
+
+			if (value.is_type<peg::string_value>())
+			{
+				values.emplace_back(std::string { value.unescaped_view() });
+			}
+			else if (value.is_type<peg::variable_value>()
+				&& variables.type() == response::Type::Map)
+			{
+				const auto itr = variables.find(variableName(value.string_view()));
+
+				if (itr == variables.end()
+					|| (itr->second.type() != response::Type::String
+						&& itr->second.type() != response::Type::ID))
+				{
+					return false;
+				}
+
+				values.emplace_back(response::Value { itr->second });
+			}
+			else
+			{
+				return false;
+			}
+		}
+		else
+		{
+			const peg::ast_node* fragmentSelectionSet = nullptr;
+
+			if (selection->is_type<peg::inline_fragment>())
+			{
+				fragmentSelectionSet =
+					findChild(*selection, [](const peg::ast_node& child) noexcept {
+						return child.is_type<peg::selection_set>();
+					});
+			}
+			else if (selection->is_type<peg::fragment_spread>())
+			{
+				const auto name = findChild(*selection, [](const peg::ast_node& child) noexcept {
+					return child.is_type<peg::fragment_name>();
+				});
+				const auto itr =
+					name ? definitions.find(name->string_view()) : definitions.end();
+
+				if (itr != definitions.end() && visited.insert(itr->first).second)
+				{
+					fragmentSelectionSet =
+						findChild(*itr->second, [](const peg::ast_node& child) noexcept {
+							return child.is_type<peg::selection_set>();
+						});
+				}
+			}
+
+			if (fragmentSelectionSet
+				&& !collectRootArguments(*fragmentSelectionSet,
+					definitions,
+					fieldName,
+					argumentName,
+					variables,
+					values,
+					visited))
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+// Collect the name of every field in the root selection set, descending into inline fragments
+// and fragment spreads. Returns false if a fragment can't be found.
+bool collectRootFields(const peg::ast_node& selectionSet, const FragmentDefinitions& definitions,
+	std::vector<std::string_view>& fields, std::set<std::string_view>& visited)
+{
+	for (const auto& selection : selectionSet.children)
+	{
+		if (selection->is_type<peg::field>())
+		{
+			const auto name = findChild(*selection, [](const peg::ast_node& child) noexcept {
+				return child.is_type<peg::field_name>();
+			});
+
+			if (name
+				&& std::find(fields.cbegin(), fields.cend(), name->string_view()) == fields.cend())
+			{
+				fields.push_back(name->string_view());
+			}
+
+			continue;
+		}
+
+		const peg::ast_node* fragmentSelectionSet = nullptr;
+
+		if (selection->is_type<peg::inline_fragment>())
+		{
+			fragmentSelectionSet = findChild(*selection, [](const peg::ast_node& child) noexcept {
+				return child.is_type<peg::selection_set>();
+			});
+		}
+		else if (selection->is_type<peg::fragment_spread>())
+		{
+			const auto name = findChild(*selection, [](const peg::ast_node& child) noexcept {
+				return child.is_type<peg::fragment_name>();
+			});
+			const auto itr = name ? definitions.find(name->string_view()) : definitions.end();
+
+			if (itr == definitions.end())
+			{
+				return false;
+			}
+
+			if (!visited.insert(itr->first).second)
+			{
+				continue;
+			}
+
+			fragmentSelectionSet =
+				findChild(*itr->second, [](const peg::ast_node& child) noexcept {
+					return child.is_type<peg::selection_set>();
+				});
+		}
+
+		if (!fragmentSelectionSet
+			|| !collectRootFields(*fragmentSelectionSet, definitions, fields, visited))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Collect the response key (the alias, or else the field name) of every field in one root
+// selection, descending into inline fragments and fragment spreads. Returns false if a fragment
+// can't be found.
+bool collectResponseKeys(const peg::ast_node& selection, const FragmentDefinitions& definitions,
+	std::set<std::string_view>& keys, std::set<std::string_view>& visited)
+{
+	if (selection.is_type<peg::field>())
+	{
+		const auto name = findChild(selection, [](const peg::ast_node& child) noexcept {
+			return child.is_type<peg::alias_name>() || child.is_type<peg::field_name>();
+		});
+
+		if (name)
+		{
+			keys.insert(name->string_view());
+		}
+
+		return true;
+	}
+
+	const peg::ast_node* fragmentSelectionSet = nullptr;
+
+	if (selection.is_type<peg::inline_fragment>())
+	{
+		fragmentSelectionSet = findChild(selection, [](const peg::ast_node& child) noexcept {
+			return child.is_type<peg::selection_set>();
+		});
+	}
+	else if (selection.is_type<peg::fragment_spread>())
+	{
+		const auto name = findChild(selection, [](const peg::ast_node& child) noexcept {
+			return child.is_type<peg::fragment_name>();
+		});
+		const auto itr = name ? definitions.find(name->string_view()) : definitions.end();
+
+		if (itr == definitions.end())
+		{
+			return false;
+		}
+
+		if (!visited.insert(itr->first).second)
+		{
+			return true;
+		}
+
+		fragmentSelectionSet = findChild(*itr->second, [](const peg::ast_node& child) noexcept {
+			return child.is_type<peg::selection_set>();
+		});
+	}
+
+	if (!fragmentSelectionSet)
+	{
+		return false;
+	}
+
+	return std::all_of(fragmentSelectionSet->children.cbegin(),
+		fragmentSelectionSet->children.cend(),
+		[&definitions, &keys, &visited](const auto& child) {
+			return collectResponseKeys(*child, definitions, keys, visited);
+		});
+}
+
+// The parts are merged shallowly at the root of the response, so it's only safe to split the
+// selections if none of them share a response key, e.g. the same field selected twice with
+// different sub-selections.
+bool hasDistinctResponseKeys(
+	const peg::ast_node& selectionSet, const FragmentDefinitions& definitions)
+{
+	std::set<std::string_view> seen;
+
+	for (const auto& selection : selectionSet.children)
+	{
+		std::set<std::string_view> keys;
+		std::set<std::string_view> visited;
+
+		if (!collectResponseKeys(*selection, definitions, keys, visited))
+		{
+			return false;
+		}
+
+		for (const auto& key : keys)
+		{
+			if (!seen.insert(key).second)
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+FragmentDefinitions findFragmentDefinitions(const peg::ast& ast)
+{
+	FragmentDefinitions definitions;
+
+	for (const auto& child : ast.root->children)
+	{
+		if (child->is_type<peg::fragment_definition>())
+		{
+			const auto name = findChild(*child, [](const peg::ast_node& node) noexcept {
+				return node.is_type<peg::fragment_name>();
+			});
+
+			if (name)
+			{
+				definitions[name->string_view()] = child.get();
+			}
+		}
+	}
+
+	return definitions;
+}
+
+} // namespace
+
+QueryRegistry::Entry::Entry(std::string hash, std::string normalized, peg::ast ast)
+	: hash(std::move(hash))
+	, normalized(std::move(normalized))
+	, ast(std::move(ast))
+{
+}
+
+QueryRegistry::Entry::Operation QueryRegistry::Entry::FindOperation(
+	service::Request& service, std::string_view operationName) const
+{
+	std::unique_lock<std::mutex> lock(_operationsMutex);
+	const auto itr = _operations.find(operationName);
+
+	if (itr != _operations.end())
+	{
+		return itr->second;
+	}
+
+	lock.unlock();
+
+	// findOperationDefinition needs a mutable AST, but it shares the parsed tree.
+	auto query = ast;
+	const auto [type, definition] = service.findOperationDefinition(query, operationName);
+	Operation operation { type == service::strSubscription
+			? service::strSubscription
+			: (type == service::strMutation ? service::strMutation : service::strQuery),
+		definition };
+
+	const auto selectionSet = definition
+		? findChild(*definition,
+			[](const peg::ast_node& child) noexcept {
+				return child.is_type<peg::selection_set>();
+			})
+		: nullptr;
+	std::set<std::string_view> visited;
+
+	if (selectionSet
+		&& collectRootFields(*selectionSet,
+			findFragmentDefinitions(ast),
+			operation.rootFields,
+			visited))
+	{
+		operation.introspection = operation.type == service::strQuery
+			&& std::all_of(operation.rootFields.cbegin(),
+				operation.rootFields.cend(),
+				[](std::string_view field) noexcept {
+					return field == "__schema" || field == "__type" || field == "__typename";
+				});
+	}
+	else
+	{
+		operation.rootFields.clear();
+	}
+
+	lock.lock();
+	_operations.emplace(std::string { operationName }, operation);
+
+	return operation;
+}
+
+std::shared_ptr<const QueryRegistry::Entry::RootParts> QueryRegistry::Entry::SplitRootSelections(
+	service::Request& service, std::string_view operationName) const
+{
+	std::unique_lock<std::mutex> lock(_operationsMutex);
+	const auto itr = _rootParts.find(operationName);
+
+	if (itr != _rootParts.end())
+	{
+		return itr->second;
+	}
+
+	lock.unlock();
+
+	auto parts = std::make_shared<RootParts>();
+	const auto operation = FindOperation(service, operationName);
+	const auto selectionSet = operation.definition
+		? findChild(*operation.definition,
+			[](const peg::ast_node& child) noexcept {
+				return child.is_type<peg::selection_set>();
+			})
+		: nullptr;
+
+	const auto definitions = findFragmentDefinitions(ast);
+
+	if (operation.type == service::strQuery && selectionSet
+		&& selectionSet->children.size() > 1
+		&& hasDistinctResponseKeys(*selectionSet, definitions))
+	{
+		const auto nameNode = findChild(*operation.definition, [](const peg::ast_node& child) {
+			return child.is_type<peg::operation_name>();
+		});
+		const auto variableDefinitions =
+			findChild(*operation.definition, [](const peg::ast_node& child) {
+				return child.is_type<peg::variable_definitions>();
+			});
+		const auto directives = findChild(*operation.definition, [](const peg::ast_node& child) {
+			return child.is_type<peg::directives>();
+		});
+
+		parts->reserve(selectionSet->children.size());
+
+		for (const auto& selection : selectionSet->children)
+		{
+			std::set<std::string_view> fragments;
+			std::set<std::string_view> variables;
+
+			collectReferences(*selection, definitions, fragments, variables);
+
+			if (directives)
+			{
+				collectReferences(*directives, definitions, fragments, variables);
+			}
+
+			// Rebuild the operation around this one selection. Validation rejects unused
+			// variables and fragments, so only carry over the ones it references.
+			std::ostringstream text;
+
+			text << service::strQuery;
+
+			if (nameNode)
+			{
+				text << ' ' << nameNode->string_view();
+			}
+
+			if (variableDefinitions && !variables.empty())
+			{
+				text << '(';
+
+				for (const auto& definition : variableDefinitions->children)
+				{
+					const auto name = findChild(*definition, [](const peg::ast_node& child) {
+						return child.is_type<peg::variable_name>();
+					});
+
+					if (name && variables.count(variableName(name->string_view())) != 0)
+					{
+						text << definition->string_view() << ' ';
+					}
+				}
+
+				text << ')';
+			}
+
+			if (directives)
+			{
+				text << ' ' << directives->string_view();
+			}
+
+			text << " { " << selection->string_view() << " }";
+
+			for (const auto& fragment : fragments)
+			{
+				const auto definition = definitions.find(fragment);
+
+				if (definition != definitions.end())
+				{
+					text << '\n' << definition->second->string_view();
+				}
+			}
+
+			auto part = peg::parseString(text.str());
+
+			// Remember that it can't be split, so every later fetch falls back to a single
+			// delivery without rebuilding and validating the parts again.
+			if (!service.validate(part).empty())
+			{
+				parts->clear();
+				break;
+			}
+
+			parts->push_back(std::move(part));
+		}
+	}
+
+	lock.lock();
+	_rootParts.emplace(std::string { operationName }, parts);
+
+	return parts;
+}
+
+std::optional<std::vector<response::Value>> QueryRegistry::Entry::FindRootArguments(
+	service::Request& service, std::string_view operationName, std::string_view fieldName,
+	std::string_view argumentName, const response::Value& variables) const
+{
+	const auto operation = FindOperation(service, operationName);
+	const auto selectionSet = operation.definition
+		? findChild(*operation.definition,
+			[](const peg::ast_node& child) noexcept {
+				return child.is_type<peg::selection_set>();
+			})
+		: nullptr;
+
+	if (!selectionSet)
+	{
+		return std::nullopt;
+	}
+
+	std::vector<response::Value> values;
+	std::set<std::string_view> visited;
+
+	if (!collectRootArguments(*selectionSet,
+			findFragmentDefinitions(ast),
+			fieldName,
+			argumentName,
+			variables,
+			values,
+			visited))
+	{
+		return std::nullopt;
+	}
+
+	return std::make_optional(std::move(values));
+}
+
+std::int32_t QueryRegistry::Register(
+	std::string_view query, service::Request& service, std::optional<Timings>* timings)
+{
+	auto normalized = Normalize(query);
+	auto hash = Hash(normalized);
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	if (auto entry = FindHash(hash, normalized))
+	{
+		return AddId(std::move(entry));
+	}
+
+	// Parsing and validation are the expensive part, and they may be running on a worker thread,
+	// so don't hold the lock while main thread callers are waiting on it.
+	lock.unlock();
+
+	const auto parseStart = std::chrono::steady_clock::now();
+	auto ast = peg::parseString(query);
+	const auto validateStart = std::chrono::steady_clock::now();
+	auto validationErrors = service.validate(ast);
+
+	if (timings)
+	{
+		*timings = Timings { validateStart - parseStart,
+			std::chrono::steady_clock::now() - validateStart };
+	}
+
+	if (!validationErrors.empty())
+	{
+		throw service::schema_exception { std::move(validationErrors) };
+	}
+
+	auto entry = std::make_shared<const Entry>(hash, std::move(normalized), std::move(ast));
+
+	lock.lock();
+
+	// Another thread may have registered the same document in the meantime, in which case we
+	// share its AST and throw ours away.
+	if (auto existing = FindHash(hash, entry->normalized))
+	{
+		return AddId(std::move(existing));
+	}
+
+	_hashes[std::move(hash)] = entry;
+
+	return AddId(std::move(entry));
+}
+
+std::optional<std::int32_t> QueryRegistry::Register(std::string_view hash)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto itr = _hashes.find(std::string { hash });
+
+	if (itr == _hashes.end())
+	{
+		return std::nullopt;
+	}
+
+	auto entry = itr->second.lock();
+
+	if (!entry)
+	{
+		_hashes.erase(itr);
+		return std::nullopt;
+	}
+
+	return std::make_optional(AddId(std::move(entry)));
+}
+
+void QueryRegistry::Release(std::int32_t queryId)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto itr = _ids.find(queryId);
+
+	if (itr == _ids.end())
+	{
+		return;
+	}
+
+	auto entry = std::move(itr->second);
+
+	_ids.erase(itr);
+
+	if (entry.use_count() > 1)
+	{
+		// Still referenced by another queryId or already retained.
+		return;
+	}
+
+	_retained.push_back(std::move(entry));
+
+	if (_retained.size() > RetainedCount)
+	{
+		const auto hash = _retained.front()->hash;
+
+		_retained.pop_front();
+
+		const auto itrHash = _hashes.find(hash);
+
+		if (itrHash != _hashes.end() && itrHash->second.expired())
+		{
+			_hashes.erase(itrHash);
+		}
+	}
+}
+
+void QueryRegistry::Clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_ids.clear();
+	_hashes.clear();
+	_retained.clear();
+}
+
+std::shared_ptr<const QueryRegistry::Entry> QueryRegistry::Find(std::int32_t queryId) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto itr = _ids.find(queryId);
+
+	return itr == _ids.end() ? nullptr : itr->second;
+}
+
+std::shared_ptr<const QueryRegistry::Entry> QueryRegistry::FindHash(
+	const std::string& hash, const std::string& normalized) const
+{
+	const auto itr = _hashes.find(hash);
+
+	if (itr == _hashes.end())
+	{
+		return nullptr;
+	}
+
+	auto entry = itr->second.lock();
+
+	// Guard against a hash collision by comparing the normalized text as well.
+	return (entry && entry->normalized == normalized) ? entry : nullptr;
+}
+
+std::int32_t QueryRegistry::AddId(std::shared_ptr<const Entry> entry)
+{
+	const auto queryId = _nextId++;
+
+	_ids.emplace(queryId, std::move(entry));
+
+	return queryId;
+}
+
+// Drop the ignored tokens (whitespace, line terminators, commas and comments) and separate the
+// remaining tokens with a single space. String values are copied verbatim. lib/preload.js has a
+// matching implementation, so the two must be kept in sync.
+std::string QueryRegistry::Normalize(std::string_view query)
+{
+	std::string result;
+	bool separate = false;
+	size_t i = 0;
+
+	result.reserve(query.size());
+
+	while (i < query.size())
+	{
+		const char ch = query[i];
+
+		switch (ch)
+		{
+			case '#':
+				while (i < query.size() && query[i] != '\n' && query[i] != '\r')
+				{
+					++i;
+				}
+
+				separate = true;
+				continue;
+
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r':
+			case ',':
+				separate = true;
+				++i;
+				continue;
+
+			default:
+				break;
+		}
+
+		if (separate && !result.empty())
+		{
+			result.push_back(' ');
+		}
+
+		separate = false;
+
+		if (ch != '"')
+		{
+			result.push_back(ch);
+			++i;
+			continue;
+		}
+
+		if (query.substr(i, 3) == R"(""")")
+		{
+			// Block string, which ends at the first unescaped triple quote.
+			auto end = i + 3;
+
+			while (end < query.size() && query.substr(end, 3) != R"(""")")
+			{
+				end += (query.substr(end, 4) == R"(\""")" ? 4 : 1);
+			}
+
+			end = std::min(end + 3, query.size());
+			result.append(query.substr(i, end - i));
+			i = end;
+			continue;
+		}
+
+		// Regular string, which ends at the next unescaped quote or line terminator.
+		auto end = i + 1;
+
+		while (end < query.size() && query[end] != '"' && query[end] != '\n' && query[end] != '\r')
+		{
+			end += (query[end] == '\\' ? 2 : 1);
+		}
+
+		end = std::min(end + 1, query.size());
+		result.append(query.substr(i, end - i));
+		i = end;
+	}
+
+	return result;
+}
+
+// 64-bit FNV-1a, formatted as 16 lowercase hex digits.
+std::string QueryRegistry::Hash(std::string_view normalized)
+{
+	std::uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (const auto ch : normalized)
+	{
+		hash ^= static_cast<std::uint8_t>(ch);
+		hash *= 0x100000001b3ULL;
+	}
+
+	std::ostringstream oss;
+
+	oss << std::hex << std::setw(16) << std::setfill('0') << hash;
+
+	return oss.str();
+}
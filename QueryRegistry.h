@@ -0,0 +1,129 @@
+#pragma once
+
+#ifndef QUERYREGISTRY_H
+#define QUERYREGISTRY_H
+
+#include "graphqlservice/GraphQLService.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Content-addressed store for parsed and validated queries. Every call to Register still gets its
+// own queryId, but identical documents (after normalizing away insignificant whitespace, commas
+// and comments) share a single AST keyed by the hash of the normalized text. Once a document is
+// known, a client can register it again by hash alone, which skips sending, parsing and validating
+// the text (automatic persisted queries).
+//
+// All of the methods are safe to call from any thread. Register releases the lock while it parses
+// and validates a new document, so a slow registration on a worker thread doesn't block Find.
+class QueryRegistry
+{
+public:
+	class Entry
+	{
+	public:
+		struct Operation
+		{
+			// One of service::strQuery, service::strMutation or service::strSubscription.
+			std::string_view type;
+
+			// nullptr if the document doesn't have a matching operation, in which case resolve
+			// reports the error.
+			const graphql::peg::ast_node* definition = nullptr;
+
+			// Every distinct field name in the root selection set, including the ones in
+			// fragments. Empty if the operation couldn't be found.
+			std::vector<std::string_view> rootFields;
+
+			// A query which only selects __schema, __type or __typename at the root, so the
+			// result only depends on the schema and the variables.
+			bool introspection = false;
+		};
+
+		// One validated document per root selection of a query operation, so each of them can be
+		// resolved and delivered on its own.
+		using RootParts = std::vector<graphql::peg::ast>;
+
+		explicit Entry(std::string hash, std::string normalized, graphql::peg::ast ast);
+
+		// Find the operation the first time each operationName is requested for this document and
+		// remember it for every queryId which shares the document.
+		Operation FindOperation(
+			graphql::service::Request& service, std::string_view operationName) const;
+
+		// Split a query operation into one document for each of its root selections, keeping only
+		// the variables and fragments each of them references. The result is empty if the
+		// operation is not a query, has fewer than 2 root selections, 2 of them share a response
+		// key, since the results are merged shallowly, or one of them fails validation on its own.
+		// Like FindOperation, it's computed once per operationName, even if it's empty.
+		std::shared_ptr<const RootParts> SplitRootSelections(
+			graphql::service::Request& service, std::string_view operationName) const;
+
+		// Collect the values of an argument on every instance of a root field in the operation,
+		// following fragments and substituting variables. Returns std::nullopt if any of them
+		// can't be determined statically, i.e. it's missing or isn't a string.
+		std::optional<std::vector<graphql::response::Value>> FindRootArguments(
+			graphql::service::Request& service, std::string_view operationName,
+			std::string_view fieldName, std::string_view argumentName,
+			const graphql::response::Value& variables) const;
+
+		const std::string hash;
+		const std::string normalized;
+		const graphql::peg::ast ast;
+
+	private:
+		mutable std::mutex _operationsMutex;
+		mutable std::map<std::string, Operation, std::less<>> _operations;
+		mutable std::map<std::string, std::shared_ptr<const RootParts>, std::less<>> _rootParts;
+	};
+
+	// Number of documents which are kept around after their last queryId is released, so a client
+	// which reloads can still register them by hash.
+	static constexpr size_t RetainedCount = 64;
+
+	struct Timings
+	{
+		std::chrono::steady_clock::duration parse {};
+		std::chrono::steady_clock::duration validate {};
+	};
+
+	// Parse and validate the query unless an identical document is already registered. If the
+	// document was parsed and validated by this call, the time each step took is stored in
+	// timings, and otherwise it's left untouched.
+	std::int32_t Register(std::string_view query, graphql::service::Request& service,
+		std::optional<Timings>* timings = nullptr);
+
+	// Register another queryId for a document which is already known by its hash.
+	std::optional<std::int32_t> Register(std::string_view hash);
+
+	void Release(std::int32_t queryId);
+	void Clear();
+
+	std::shared_ptr<const Entry> Find(std::int32_t queryId) const;
+
+	static std::string Normalize(std::string_view query);
+	static std::string Hash(std::string_view normalized);
+
+private:
+	// These expect the caller to already hold _mutex.
+	std::shared_ptr<const Entry> FindHash(
+		const std::string& hash, const std::string& normalized) const;
+	std::int32_t AddId(std::shared_ptr<const Entry> entry);
+
+	mutable std::mutex _mutex;
+	std::int32_t _nextId = 1;
+	std::map<std::int32_t, std::shared_ptr<const Entry>> _ids;
+	std::unordered_map<std::string, std::weak_ptr<const Entry>> _hashes;
+	std::deque<std::shared_ptr<const Entry>> _retained;
+};
+
+#endif // QUERYREGISTRY_H
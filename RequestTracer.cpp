@@ -0,0 +1,250 @@
+#include "RequestTracer.h"
+
+#include "graphqlservice/JSONResponse.h"
+
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+using namespace graphql;
+
+namespace {
+
+constexpr std::string_view strTracing = "tracing";
+constexpr std::string_view strExtensions = "extensions";
+
+constexpr std::array<std::string_view, 5> s_stageNames = {
+	"parsing",
+	"validation",
+	"execution",
+	"serialization",
+	"delivery",
+};
+
+// Integers are only 32 bits, so anything longer than about 2 seconds becomes a Float.
+response::Value nanoseconds(RequestTracer::Clock::duration duration)
+{
+	const auto count = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+
+	return count <= std::numeric_limits<int>::max()
+		? response::Value { static_cast<int>(count) }
+		: response::Value { static_cast<double>(count) };
+}
+
+// RFC 3339 in UTC with milliseconds.
+std::string formatTime(std::chrono::system_clock::time_point time)
+{
+	const auto seconds = std::chrono::system_clock::to_time_t(time);
+	const auto milliseconds =
+		std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count()
+		% 1000;
+	std::tm utc {};
+
+#ifdef _WIN32
+	gmtime_s(&utc, &seconds);
+#else
+	gmtime_r(&seconds, &utc);
+#endif
+
+	std::ostringstream oss;
+
+	oss << std::put_time(&utc, "%Y-%m-%dT%H:%M:%S") << '.' << std::setw(3) << std::setfill('0')
+		<< milliseconds << 'Z';
+
+	return oss.str();
+}
+
+response::Value truncatePath(const response::ListType& path, size_t size)
+{
+	response::Value result { response::Type::List };
+
+	result.reserve(size);
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		result.emplace_back(response::Value { path[i] });
+	}
+
+	return result;
+}
+
+} // namespace
+
+RequestTracer::RequestTracer()
+	: _startTime { std::chrono::system_clock::now() }
+	, _start { Clock::now() }
+{
+}
+
+void RequestTracer::BeginStage(Stage stage)
+{
+	const auto now = Clock::now();
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_stages[static_cast<size_t>(stage)] = std::make_optional(Span { now, now });
+}
+
+void RequestTracer::EndStage(Stage stage)
+{
+	const auto now = Clock::now();
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto& span = _stages[static_cast<size_t>(stage)];
+
+	if (span)
+	{
+		span->end = now;
+	}
+}
+
+void RequestTracer::BeginSelectionSet(
+	std::string_view typeName, const service::SelectionSetParams& params)
+{
+	const auto now = Clock::now();
+	auto path = service::buildErrorPath(params.errorPath);
+	auto key = response::toJSON(response::Value { path });
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (_paths.emplace(std::move(key), _selectionSets.size()).second)
+	{
+		_selectionSets.push_back({ std::move(path), typeName, { now, now } });
+	}
+}
+
+void RequestTracer::EndSelectionSet(const service::SelectionSetParams& params)
+{
+	const auto now = Clock::now();
+	const auto key = response::toJSON(service::buildErrorPath(params.errorPath));
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto itr = _paths.find(key);
+
+	if (itr != _paths.end())
+	{
+		_selectionSets[itr->second].span.end = now;
+	}
+}
+
+void RequestTracer::AddTo(response::Value& document) const
+{
+	response::Value extensions { response::Type::Map };
+
+	extensions.emplace_back(std::string { strTracing }, MakeExtension());
+	document.emplace_back(std::string { strExtensions }, std::move(extensions));
+}
+
+void RequestTracer::AddTo(std::string& json) const
+{
+	if (json.empty() || json.back() != '}')
+	{
+		return;
+	}
+
+	json.pop_back();
+
+	if (json.size() > 1)
+	{
+		json.push_back(',');
+	}
+
+	json.append(R"js("extensions":{"tracing":)js");
+	json.append(response::toJSON(MakeExtension()));
+	json.append("}}");
+}
+
+response::Value RequestTracer::MakeExtension() const
+{
+	const auto end = Clock::now();
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::vector<Clock::time_point> subtreeEnds(_selectionSets.size());
+	std::vector<std::optional<size_t>> parents(_selectionSets.size());
+
+	for (size_t i = 0; i < _selectionSets.size(); ++i)
+	{
+		subtreeEnds[i] = std::max(subtreeEnds[i], _selectionSets[i].span.end);
+
+		const auto& path = _selectionSets[i].path.get<response::ListType>();
+
+		// Extend every enclosing object to the end of this one, and remember the closest one as
+		// the parent type.
+		for (size_t size = path.size(); size-- > 0;)
+		{
+			const auto itr = _paths.find(response::toJSON(truncatePath(path, size)));
+
+			if (itr == _paths.end())
+			{
+				continue;
+			}
+
+			if (!parents[i])
+			{
+				parents[i] = std::make_optional(itr->second);
+			}
+
+			subtreeEnds[itr->second] =
+				std::max(subtreeEnds[itr->second], _selectionSets[i].span.end);
+		}
+	}
+
+	response::Value resolvers { response::Type::List };
+
+	resolvers.reserve(_selectionSets.size());
+
+	for (size_t i = 0; i < _selectionSets.size(); ++i)
+	{
+		const auto& selectionSet = _selectionSets[i];
+		const auto& path = selectionSet.path.get<response::ListType>();
+		const auto fieldName = std::find_if(path.crbegin(), path.crend(), [](const auto& segment) {
+			return segment.type() == response::Type::String;
+		});
+
+		// The root operation type is already covered by the execution stage.
+		if (fieldName == path.crend())
+		{
+			continue;
+		}
+
+		response::Value resolver { response::Type::Map };
+
+		resolver.reserve(6);
+		resolver.emplace_back("path", response::Value { selectionSet.path });
+		resolver.emplace_back("parentType",
+			parents[i] ? response::Value { std::string { _selectionSets[*parents[i]].typeName } }
+					   : response::Value {});
+		resolver.emplace_back("fieldName", response::Value { *fieldName });
+		resolver.emplace_back("returnType",
+			response::Value { std::string { selectionSet.typeName } });
+		resolver.emplace_back("startOffset", nanoseconds(selectionSet.span.start - _start));
+		resolver.emplace_back("duration", nanoseconds(subtreeEnds[i] - selectionSet.span.start));
+		resolvers.emplace_back(std::move(resolver));
+	}
+
+	response::Value tracing { response::Type::Map };
+
+	tracing.emplace_back("version", response::Value { 1 });
+	tracing.emplace_back("startTime", response::Value { formatTime(_startTime) });
+	tracing.emplace_back("endTime",
+		response::Value { formatTime(_startTime
+			+ std::chrono::duration_cast<std::chrono::system_clock::duration>(end - _start)) });
+	tracing.emplace_back("duration", nanoseconds(end - _start));
+
+	for (size_t i = 0; i < StageCount; ++i)
+	{
+		response::Value stage { response::Type::Map };
+
+		if (_stages[i])
+		{
+			stage.emplace_back("startOffset", nanoseconds(_stages[i]->start - _start));
+			stage.emplace_back("duration", nanoseconds(_stages[i]->end - _stages[i]->start));
+		}
+
+		if (static_cast<Stage>(i) == Stage::Execution)
+		{
+			stage.emplace_back("resolvers", std::move(resolvers));
+		}
+
+		tracing.emplace_back(std::string { s_stageNames[i] }, std::move(stage));
+	}
+
+	return tracing;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#ifndef REQUESTTRACER_H
+#define REQUESTTRACER_H
+
+#include "graphqlservice/GraphQLService.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Timestamps for each stage of a single fetchQuery, and for each object in the response, which are
+// returned as an Apollo tracing style extension:
+//   { "extensions": { "tracing": { "version": 1, "startTime", "endTime", "duration",
+//     "parsing", "validation", "execution": { "resolvers": [ ... ] }, "serialization",
+//     "delivery" } } }
+// Durations and offsets are in nanoseconds from the start of the request. The objects are timed by
+// their beginSelectionSet and endSelectionSet, and since nested objects may be resolved on other
+// threads after their parent's endSelectionSet, each resolver's duration extends to the end of the
+// last object beneath it.
+//
+// All of the methods are safe to call from any thread.
+class RequestTracer
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	enum class Stage
+	{
+		// Converting the variables.
+		Parsing,
+
+		// Finding the operation in the validated document.
+		Validation,
+
+		// The whole call to resolve.
+		Execution,
+
+		// Converting the response document to JSON.
+		Serialization,
+
+		// The hop from the resolver thread to the main thread.
+		Delivery,
+	};
+
+	RequestTracer();
+
+	void BeginStage(Stage stage);
+	void EndStage(Stage stage);
+
+	void BeginSelectionSet(
+		std::string_view typeName, const graphql::service::SelectionSetParams& params);
+	void EndSelectionSet(const graphql::service::SelectionSetParams& params);
+
+	// Add extensions.tracing to the response document, or splice it into the end of the JSON.
+	void AddTo(graphql::response::Value& document) const;
+	void AddTo(std::string& json) const;
+
+private:
+	static constexpr size_t StageCount = static_cast<size_t>(Stage::Delivery) + 1;
+
+	struct Span
+	{
+		Clock::time_point start;
+		Clock::time_point end;
+	};
+
+	struct SelectionSet
+	{
+		graphql::response::Value path;
+		std::string_view typeName;
+		Span span;
+	};
+
+	graphql::response::Value MakeExtension() const;
+
+	const std::chrono::system_clock::time_point _startTime;
+	const Clock::time_point _start;
+
+	mutable std::mutex _mutex;
+	std::array<std::optional<Span>, StageCount> _stages;
+	std::vector<SelectionSet> _selectionSets;
+
+	// Index in _selectionSets by the JSON of the path.
+	std::unordered_map<std::string, size_t> _paths;
+};
+
+#endif // REQUESTTRACER_H
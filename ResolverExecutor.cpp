@@ -0,0 +1,148 @@
+#include "ResolverExecutor.h"
+
+#include <algorithm>
+#include <iostream>
+
+ResolverExecutor::ResolverExecutor(size_t threadCount, size_t queueDepth)
+	: _queueDepth(std::max<size_t>(queueDepth, 1))
+{
+	threadCount = std::max<size_t>(threadCount, 1);
+	_threads.reserve(threadCount);
+
+	for (size_t i = 0; i < threadCount; ++i)
+	{
+		_threads.emplace_back([this]() noexcept {
+			Run();
+		});
+	}
+}
+
+ResolverExecutor::~ResolverExecutor()
+{
+	Stop();
+}
+
+bool ResolverExecutor::Post(Task&& task)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	if (_stopped || _tasks.size() >= _queueDepth)
+	{
+		return false;
+	}
+
+	_tasks.push(std::move(task));
+
+	lock.unlock();
+	_condition.notify_one();
+
+	return true;
+}
+
+bool ResolverExecutor::PostWait(Task&& task)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	_space.wait(lock, [this]() noexcept -> bool {
+		return _stopped || _tasks.size() < _queueDepth;
+	});
+
+	if (_stopped)
+	{
+		return false;
+	}
+
+	_tasks.push(std::move(task));
+
+	lock.unlock();
+	_condition.notify_one();
+
+	return true;
+}
+
+void ResolverExecutor::Stop()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	if (_stopped)
+	{
+		return;
+	}
+
+	_stopped = true;
+
+	lock.unlock();
+	_condition.notify_all();
+	_space.notify_all();
+
+	for (auto& thread : _threads)
+	{
+		thread.join();
+	}
+
+	_threads.clear();
+}
+
+size_t ResolverExecutor::ThreadCount() const noexcept
+{
+	return _threads.size();
+}
+
+size_t ResolverExecutor::QueueDepth() const noexcept
+{
+	return _queueDepth;
+}
+
+size_t ResolverExecutor::QueuedCount() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	return _tasks.size();
+}
+
+size_t ResolverExecutor::ActiveCount() const noexcept
+{
+	return _active.load(std::memory_order_relaxed);
+}
+
+size_t ResolverExecutor::DefaultThreadCount() noexcept
+{
+	return std::max<size_t>(std::thread::hardware_concurrency(), 2);
+}
+
+void ResolverExecutor::Run()
+{
+	while (true)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		_condition.wait(lock, [this]() noexcept -> bool {
+			return _stopped || !_tasks.empty();
+		});
+
+		if (_tasks.empty())
+		{
+			// Only reachable once we've been stopped and the queue is drained.
+			return;
+		}
+
+		auto task = std::move(_tasks.front());
+
+		_tasks.pop();
+		lock.unlock();
+		_space.notify_one();
+
+		_active.fetch_add(1, std::memory_order_relaxed);
+
+		try
+		{
+			task();
+		}
+		catch (const std::exception& ex)
+		{
+			std::cerr << "Caught exception in resolver task: " << ex.what() << std::endl;
+		}
+
+		_active.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
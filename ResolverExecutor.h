@@ -0,0 +1,65 @@
+#pragma once
+
+#ifndef RESOLVEREXECUTOR_H
+#define RESOLVEREXECUTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads which resolves queries and mutations. It is owned by the
+// module instead of borrowing threads from the libuv threadpool, so a long-running operation never
+// starves fs/crypto/etc. work on the Node side. The pending task queue is bounded, and Post refuses
+// new work instead of growing without limit once it is full.
+class ResolverExecutor
+{
+public:
+	using Task = std::function<void()>;
+
+	static constexpr size_t DefaultQueueDepth = 1024;
+
+	explicit ResolverExecutor(size_t threadCount, size_t queueDepth);
+	~ResolverExecutor();
+
+	// Returns false if the queue is already full or the executor is shutting down.
+	bool Post(Task&& task);
+
+	// Waits for room in the queue instead of refusing the task, so the caller is held back until
+	// the workers catch up. Returns false only if the executor is shutting down. Must not be called
+	// from one of this executor's own threads.
+	bool PostWait(Task&& task);
+
+	// Finish any tasks which are already queued and join all of the worker threads.
+	void Stop();
+
+	size_t ThreadCount() const noexcept;
+	size_t QueueDepth() const noexcept;
+
+	// Snapshots for metrics: the number of tasks waiting for a thread, and the number of threads
+	// which are running a task right now.
+	size_t QueuedCount() const;
+	size_t ActiveCount() const noexcept;
+
+	static size_t DefaultThreadCount() noexcept;
+
+private:
+	void Run();
+
+	const size_t _queueDepth;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _condition;
+	std::condition_variable _space;
+	std::queue<Task> _tasks;
+	bool _stopped = false;
+	std::atomic<size_t> _active { 0 };
+
+	std::vector<std::thread> _threads;
+};
+
+#endif // RESOLVEREXECUTOR_H
@@ -0,0 +1,233 @@
+#include "ResponseCache.h"
+
+#include "graphqlservice/JSONResponse.h"
+
+#include <algorithm>
+
+using namespace graphql;
+
+namespace {
+
+// Rough per-entry bookkeeping on top of the key, the JSON and the document: the map node, the LRU
+// node and the node id index.
+constexpr size_t EntryOverhead = 128;
+
+response::Value canonicalize(const response::Value& value)
+{
+	switch (value.type())
+	{
+		case response::Type::Map:
+		{
+			std::vector<const std::pair<std::string, response::Value>*> members;
+
+			members.reserve(value.size());
+
+			for (const auto& member : value)
+			{
+				members.push_back(&member);
+			}
+
+			std::sort(members.begin(), members.end(), [](const auto* lhs, const auto* rhs) {
+				return lhs->first < rhs->first;
+			});
+
+			response::Value result { response::Type::Map };
+
+			result.reserve(members.size());
+
+			for (const auto* member : members)
+			{
+				result.emplace_back(std::string { member->first }, canonicalize(member->second));
+			}
+
+			return result;
+		}
+
+		case response::Type::List:
+		{
+			response::Value result { response::Type::List };
+
+			result.reserve(value.size());
+
+			for (const auto& entry : value.get<response::ListType>())
+			{
+				result.emplace_back(canonicalize(entry));
+			}
+
+			return result;
+		}
+
+		default:
+			return response::Value { value };
+	}
+}
+
+} // namespace
+
+ResponseCache::ResponseCache(size_t maxBytes)
+	: _maxBytes(maxBytes)
+{
+}
+
+std::string ResponseCache::MakeKey(const QueryRegistry::Entry& query,
+	std::string_view operationName, const response::Value& variables)
+{
+	std::string key { query.hash };
+
+	key.push_back('\n');
+	key.append(operationName);
+	key.push_back('\n');
+	key.append(CanonicalJSON(variables));
+
+	return key;
+}
+
+std::string ResponseCache::CanonicalJSON(const response::Value& value)
+{
+	return response::toJSON(canonicalize(value));
+}
+
+std::shared_ptr<const ResponseCache::Result> ResponseCache::Find(
+	const std::string& key, const std::string& normalized, std::uint64_t& generation)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto itr = _entries.find(key);
+
+	if (itr == _entries.end() || itr->second.normalized != normalized)
+	{
+		++_stats.misses;
+		generation = _generation;
+		return nullptr;
+	}
+
+	++_stats.hits;
+	_lru.splice(_lru.end(), _lru, itr->second.lru);
+
+	return itr->second.result;
+}
+
+std::shared_ptr<const ResponseCache::Result> ResponseCache::Insert(std::string key,
+	const std::string& normalized, std::uint64_t generation, response::Value&& document,
+	std::set<response::IdType> nodeIds)
+{
+	const auto errors = document.find(service::strErrors);
+	const bool cacheable =
+		errors == document.end() || errors->second.type() == response::Type::Null;
+	auto json = response::toJSON(response::Value { document });
+	const auto bytes = key.size() + normalized.size() + 2 * json.size() + EntryOverhead
+		+ nodeIds.size() * EntryOverhead;
+	auto result = std::make_shared<const Result>(Result { std::move(document), std::move(json) });
+
+	if (!cacheable || bytes > _maxBytes)
+	{
+		return result;
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	// One of the nodes may have changed while this was being resolved.
+	if (generation != _generation)
+	{
+		return result;
+	}
+
+	const auto existing = _entries.find(key);
+
+	if (existing != _entries.end())
+	{
+		Erase(existing);
+	}
+
+	for (const auto& nodeId : nodeIds)
+	{
+		_nodeEntries[nodeId].insert(key);
+	}
+
+	const auto lru = _lru.insert(_lru.end(), key);
+
+	_entries.emplace(std::move(key), Entry { normalized, result, std::move(nodeIds), lru, bytes });
+	_stats.bytes += bytes;
+	Evict();
+
+	return result;
+}
+
+void ResponseCache::Invalidate(const response::IdType& nodeId)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	++_generation;
+
+	const auto itrNode = _nodeEntries.find(nodeId);
+
+	if (itrNode == _nodeEntries.end())
+	{
+		return;
+	}
+
+	// Erase updates _nodeEntries, so work from a copy of the keys.
+	const auto keys = itrNode->second;
+
+	for (const auto& key : keys)
+	{
+		const auto itr = _entries.find(key);
+
+		if (itr != _entries.end())
+		{
+			++_stats.invalidations;
+			Erase(itr);
+		}
+	}
+}
+
+void ResponseCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	++_generation;
+	_entries.clear();
+	_lru.clear();
+	_nodeEntries.clear();
+	_stats.bytes = 0;
+}
+
+ResponseCache::Stats ResponseCache::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto stats = _stats;
+
+	stats.entries = _entries.size();
+
+	return stats;
+}
+
+void ResponseCache::Erase(EntryMap::iterator itr)
+{
+	for (const auto& nodeId : itr->second.nodeIds)
+	{
+		const auto itrNode = _nodeEntries.find(nodeId);
+
+		if (itrNode != _nodeEntries.end())
+		{
+			itrNode->second.erase(itr->first);
+
+			if (itrNode->second.empty())
+			{
+				_nodeEntries.erase(itrNode);
+			}
+		}
+	}
+
+	_stats.bytes -= itr->second.bytes;
+	_lru.erase(itr->second.lru);
+	_entries.erase(itr);
+}
+
+void ResponseCache::Evict()
+{
+	while (_stats.bytes > _maxBytes && !_lru.empty())
+	{
+		++_stats.evictions;
+		Erase(_entries.find(_lru.front()));
+	}
+}
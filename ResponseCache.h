@@ -0,0 +1,106 @@
+#pragma once
+
+#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+
+#include "QueryRegistry.h"
+
+#include "graphqlservice/GraphQLService.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Query results keyed by the document hash, the operation name and the variables in
+// canonical form (object members sorted by name), so several windows fetching the same query only
+// resolve it once. Each entry is tagged with the ids of the nodes the query resolved, and a
+// mutation of one of those nodes invalidates just the entries which read it. The least recently
+// used entries are evicted to stay under the memory limit. Like the IntrospectionCache, each entry
+// keeps both the document and its JSON, so a hit doesn't need to parse the JSON again for object
+// output, and the document counts towards the limit as roughly the size of its JSON again.
+//
+// All of the methods are safe to call from any thread.
+class ResponseCache
+{
+public:
+	struct Result
+	{
+		graphql::response::Value document;
+		std::string json;
+	};
+
+	struct Stats
+	{
+		std::uint64_t hits = 0;
+		std::uint64_t misses = 0;
+		std::uint64_t evictions = 0;
+		std::uint64_t invalidations = 0;
+		size_t entries = 0;
+		size_t bytes = 0;
+	};
+
+	explicit ResponseCache(size_t maxBytes);
+
+	static std::string MakeKey(const QueryRegistry::Entry& query, std::string_view operationName,
+		const graphql::response::Value& variables);
+
+	// The JSON of the value with the members of every object sorted by name, so the same variables
+	// in a different order make the same key. The IntrospectionCache keys on it too.
+	static std::string CanonicalJSON(const graphql::response::Value& value);
+
+	// Returns nullptr on a miss, and sets generation to the value which has to be passed to Insert,
+	// so a result which was resolved before an invalidation isn't added afterwards.
+	std::shared_ptr<const Result> Find(const std::string& key, const std::string& normalized,
+		std::uint64_t& generation);
+
+	// Serializes the document and keeps it unless it has errors. Returns the result either way, so
+	// the caller can deliver it.
+	std::shared_ptr<const Result> Insert(std::string key, const std::string& normalized,
+		std::uint64_t generation, graphql::response::Value&& document,
+		std::set<graphql::response::IdType> nodeIds);
+
+	// Drop every entry which resolved this node.
+	void Invalidate(const graphql::response::IdType& nodeId);
+
+	void Clear();
+
+	Stats GetStats() const;
+
+private:
+	using LruList = std::list<std::string>;
+
+	struct Entry
+	{
+		// Guards against a collision between the document hashes in the key.
+		std::string normalized;
+		std::shared_ptr<const Result> result;
+		std::set<graphql::response::IdType> nodeIds;
+		LruList::iterator lru;
+		size_t bytes = 0;
+	};
+
+	using EntryMap = std::unordered_map<std::string, Entry>;
+
+	// These expect the caller to already hold _mutex.
+	void Erase(EntryMap::iterator itr);
+	void Evict();
+
+	const size_t _maxBytes;
+
+	mutable std::mutex _mutex;
+	EntryMap _entries;
+	LruList _lru;
+	std::map<graphql::response::IdType, std::set<std::string>> _nodeEntries;
+	std::uint64_t _generation = 0;
+	Stats _stats;
+};
+
+#endif // RESPONSECACHE_H
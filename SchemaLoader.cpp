@@ -0,0 +1,31 @@
+#include "SchemaLoader.h"
+
+#include "TodaySchema.h"
+
+#include <future>
+#include <mutex>
+
+using namespace graphql;
+
+namespace {
+
+std::once_flag s_preloadFlag;
+std::shared_future<std::shared_ptr<schema::Schema>> s_schema;
+
+} // namespace
+
+void preloadSchema()
+{
+	std::call_once(s_preloadFlag, []() {
+		s_schema = std::async(std::launch::async, []() {
+			return today::GetSchema();
+		}).share();
+	});
+}
+
+std::shared_ptr<schema::Schema> getSchema()
+{
+	preloadSchema();
+
+	return s_schema.get();
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#ifndef SCHEMALOADER_H
+#define SCHEMALOADER_H
+
+#include "graphqlservice/internal/Schema.h"
+
+#include <memory>
+
+// The generated today::GetSchema builds the whole schema, including the introspection types, with
+// a few thousand small allocations, and it only caches it in a weak_ptr, so it's rebuilt every time
+// the last service which was using it goes away. These build it once per process on a background
+// thread, starting as soon as the module is loaded, and keep it alive until the process exits. That
+// takes it off the startService path and makes it safe to share between worker_threads.
+
+// Called on any thread. Starts building the schema if nobody has asked for it yet.
+void preloadSchema();
+
+// Called on any thread. Waits for the schema if it's still being built.
+std::shared_ptr<graphql::schema::Schema> getSchema();
+
+#endif // SCHEMALOADER_H
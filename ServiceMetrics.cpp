@@ -0,0 +1,205 @@
+#include "ServiceMetrics.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+
+std::atomic<size_t> s_nextShard { 0 };
+
+// Spread the threads across the shards in the order they first record something.
+size_t currentShard(size_t shardCount) noexcept
+{
+	static thread_local const size_t shard = s_nextShard++;
+
+	return shard % shardCount;
+}
+
+constexpr std::array<double, 4> s_quantiles = { 0.5, 0.9, 0.99, 0.999 };
+
+double toSeconds(std::uint64_t nanoseconds) noexcept
+{
+	return static_cast<double>(nanoseconds) / 1e9;
+}
+
+} // namespace
+
+std::uint64_t LatencyHistogram::Snapshot::Percentile(double percentile) const noexcept
+{
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	const auto rank = std::max<std::uint64_t>(1,
+		static_cast<std::uint64_t>(std::ceil(percentile / 100.0 * static_cast<double>(count))));
+	std::uint64_t seen = 0;
+
+	for (size_t i = 0; i < buckets.size(); ++i)
+	{
+		seen += buckets[i];
+
+		if (seen >= rank)
+		{
+			return std::min(BucketUpperBound(i), max);
+		}
+	}
+
+	return max;
+}
+
+void LatencyHistogram::Record(Clock::duration duration) noexcept
+{
+	const auto nanoseconds = static_cast<std::uint64_t>(std::max<std::int64_t>(0,
+		std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()));
+	auto& shard = _shards[currentShard(ShardCount)];
+
+	shard.buckets[BucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+	shard.count.fetch_add(1, std::memory_order_relaxed);
+	shard.sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+	auto max = shard.max.load(std::memory_order_relaxed);
+
+	while (nanoseconds > max
+		&& !shard.max.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed))
+	{
+	}
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::Read() const noexcept
+{
+	Snapshot result;
+
+	for (const auto& shard : _shards)
+	{
+		for (size_t i = 0; i < BucketCount; ++i)
+		{
+			result.buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+		}
+
+		result.count += shard.count.load(std::memory_order_relaxed);
+		result.sum += shard.sum.load(std::memory_order_relaxed);
+		result.max = std::max(result.max, shard.max.load(std::memory_order_relaxed));
+	}
+
+	return result;
+}
+
+size_t LatencyHistogram::BucketIndex(std::uint64_t nanoseconds) noexcept
+{
+	if (nanoseconds < 2 * SubBucketCount)
+	{
+		return static_cast<size_t>(nanoseconds);
+	}
+
+	const auto exponent =
+		std::min<size_t>(static_cast<size_t>(std::bit_width(nanoseconds)) - 1, MaxExponent);
+	const auto subBucket = std::min<std::uint64_t>(
+		(nanoseconds >> (exponent - SubBucketBits)) - SubBucketCount,
+		SubBucketCount - 1);
+
+	return 2 * SubBucketCount + (exponent - SubBucketBits - 1) * SubBucketCount
+		+ static_cast<size_t>(subBucket);
+}
+
+std::uint64_t LatencyHistogram::BucketUpperBound(size_t index) noexcept
+{
+	if (index < 2 * SubBucketCount)
+	{
+		return index;
+	}
+
+	const auto exponent = SubBucketBits + 1 + (index - 2 * SubBucketCount) / SubBucketCount;
+	const auto subBucket = (index - 2 * SubBucketCount) % SubBucketCount;
+	const auto width = std::uint64_t { 1 } << (exponent - SubBucketBits);
+
+	return (SubBucketCount + subBucket) * width + width - 1;
+}
+
+void ServiceMetrics::Record(Stage stage, std::string_view operationType,
+	LatencyHistogram::Clock::duration duration) noexcept
+{
+	const auto operation = static_cast<size_t>(
+		std::find(OperationNames.cbegin(), OperationNames.cend(), operationType)
+		- OperationNames.cbegin());
+
+	if (operation < OperationNames.size())
+	{
+		_histograms[static_cast<size_t>(stage) * OperationNames.size() + operation].Record(
+			duration);
+	}
+}
+
+const LatencyHistogram& ServiceMetrics::Histogram(Stage stage, size_t operation) const noexcept
+{
+	return _histograms[static_cast<size_t>(stage) * OperationNames.size() + operation];
+}
+
+std::string ServiceMetrics::FormatText(const std::vector<Gauge>& gauges) const
+{
+	std::ostringstream oss;
+	const auto writeSummary = [&oss](std::string_view name,
+								  const std::string& labels,
+								  const LatencyHistogram::Snapshot& snapshot) {
+		const auto separator = labels.empty() ? "" : ",";
+
+		for (const auto quantile : s_quantiles)
+		{
+			oss << name << '{' << labels << separator << "quantile=\"" << quantile << "\"} "
+				<< toSeconds(snapshot.Percentile(quantile * 100.0)) << '\n';
+		}
+
+		oss << name << "_sum" << (labels.empty() ? "" : "{") << labels
+			<< (labels.empty() ? "" : "}") << ' ' << toSeconds(snapshot.sum) << '\n';
+		oss << name << "_count" << (labels.empty() ? "" : "{") << labels
+			<< (labels.empty() ? "" : "}") << ' ' << snapshot.count << '\n';
+	};
+
+	oss << std::setprecision(9);
+	oss << "# HELP cppgraphql_stage_duration_seconds Time spent in each stage of a request.\n"
+		<< "# TYPE cppgraphql_stage_duration_seconds summary\n";
+
+	for (size_t stage = 0; stage < StageNames.size(); ++stage)
+	{
+		for (size_t operation = 0; operation < OperationNames.size(); ++operation)
+		{
+			const auto snapshot = Histogram(static_cast<Stage>(stage), operation).Read();
+
+			if (snapshot.count == 0)
+			{
+				continue;
+			}
+
+			std::ostringstream labels;
+
+			labels << "stage=\"" << StageNames[stage] << "\",operation=\""
+				   << OperationNames[operation] << '"';
+			writeSummary("cppgraphql_stage_duration_seconds", labels.str(), snapshot);
+		}
+	}
+
+	oss << "# HELP cppgraphql_delivery_lag_seconds Time from a mutation queueing a change event "
+		   "until it is delivered.\n"
+		<< "# TYPE cppgraphql_delivery_lag_seconds summary\n";
+	writeSummary("cppgraphql_delivery_lag_seconds", {}, deliveryLag.Read());
+
+	std::string_view previous;
+
+	for (const auto& gauge : gauges)
+	{
+		if (gauge.name != previous)
+		{
+			oss << "# HELP " << gauge.name << ' ' << gauge.help << '\n'
+				<< "# TYPE " << gauge.name << " gauge\n";
+			previous = gauge.name;
+		}
+
+		oss << gauge.name << (gauge.labels.empty() ? "" : "{") << gauge.labels
+			<< (gauge.labels.empty() ? "" : "}") << ' ' << gauge.value << '\n';
+	}
+
+	return oss.str();
+}
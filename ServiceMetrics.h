@@ -0,0 +1,117 @@
+#pragma once
+
+#ifndef SERVICEMETRICS_H
+#define SERVICEMETRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// HDR-style latency histogram: 8 linear sub-buckets for each power of 2 nanoseconds, so every
+// recorded value is within 12.5% of its bucket's upper bound, from 1ns up to about 18 minutes.
+// Recording is lock-free: each thread adds to one of a fixed set of shards with relaxed atomics,
+// and Read merges the shards, so it can run on the hot path without perturbing it.
+class LatencyHistogram
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr size_t SubBucketBits = 3;
+	static constexpr size_t SubBucketCount = 1 << SubBucketBits;
+	static constexpr size_t MaxExponent = 40;
+	static constexpr size_t BucketCount =
+		2 * SubBucketCount + (MaxExponent - SubBucketBits) * SubBucketCount;
+
+	struct Snapshot
+	{
+		std::uint64_t count = 0;
+		std::uint64_t sum = 0;
+		std::uint64_t max = 0;
+		std::array<std::uint64_t, BucketCount> buckets {};
+
+		// The upper bound in nanoseconds of the bucket which contains the percentile.
+		std::uint64_t Percentile(double percentile) const noexcept;
+	};
+
+	void Record(Clock::duration duration) noexcept;
+	Snapshot Read() const noexcept;
+
+	static size_t BucketIndex(std::uint64_t nanoseconds) noexcept;
+	static std::uint64_t BucketUpperBound(size_t index) noexcept;
+
+private:
+	static constexpr size_t ShardCount = 8;
+
+	struct alignas(64) Shard
+	{
+		std::array<std::atomic<std::uint64_t>, BucketCount> buckets {};
+		std::atomic<std::uint64_t> count { 0 };
+		std::atomic<std::uint64_t> sum { 0 };
+		std::atomic<std::uint64_t> max { 0 };
+	};
+
+	std::array<Shard, ShardCount> _shards;
+};
+
+// Latency histograms for each stage of each operation type, plus the lag between a mutation
+// queueing a change event and the delivery thread picking it up. The gauges are sampled by the
+// caller when it reads the metrics.
+class ServiceMetrics
+{
+public:
+	enum class Stage
+	{
+		Parse,
+		Validate,
+		Execute,
+		Serialize,
+	};
+
+	static constexpr std::array<std::string_view, 4> StageNames = {
+		"parse",
+		"validate",
+		"execute",
+		"serialize",
+	};
+
+	// Documents are parsed and validated in parseQuery, before any operation has been picked, so
+	// those stages are recorded for the "document" rather than an operation type.
+	static constexpr std::array<std::string_view, 4> OperationNames = {
+		"document",
+		"query",
+		"mutation",
+		"subscription",
+	};
+
+	struct Gauge
+	{
+		std::string_view name;
+		std::string_view help;
+
+		// Already formatted, e.g. R"(executor="resolver")", or empty.
+		std::string labels;
+		double value = 0.0;
+	};
+
+	// Called on any thread. The operation type is one of the OperationNames.
+	void Record(Stage stage, std::string_view operationType,
+		LatencyHistogram::Clock::duration duration) noexcept;
+
+	const LatencyHistogram& Histogram(Stage stage, size_t operation) const noexcept;
+
+	// Prometheus text exposition format, with a summary for each histogram which has samples and
+	// the gauges grouped by name.
+	std::string FormatText(const std::vector<Gauge>& gauges) const;
+
+	LatencyHistogram deliveryLag;
+
+private:
+	std::array<LatencyHistogram, StageNames.size() * OperationNames.size()> _histograms;
+};
+
+#endif // SERVICEMETRICS_H
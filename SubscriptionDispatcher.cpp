@@ -0,0 +1,88 @@
+#include "SubscriptionDispatcher.h"
+
+#include <algorithm>
+
+SubscriptionDispatcher::SubscriptionDispatcher(size_t threadCount)
+{
+	threadCount = std::max<size_t>(threadCount, 1);
+	_threads.reserve(threadCount);
+
+	for (size_t i = 0; i < threadCount; ++i)
+	{
+		_threads.emplace_back([this]() noexcept {
+			Run();
+		});
+	}
+}
+
+SubscriptionDispatcher::~SubscriptionDispatcher()
+{
+	Stop();
+}
+
+void SubscriptionDispatcher::MarkReady(std::shared_ptr<Target> target)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	if (_stopped)
+	{
+		return;
+	}
+
+	_ready.push_back(std::move(target));
+
+	lock.unlock();
+	_condition.notify_one();
+}
+
+void SubscriptionDispatcher::Stop()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	if (_stopped)
+	{
+		return;
+	}
+
+	_stopped = true;
+
+	lock.unlock();
+	_condition.notify_all();
+
+	for (auto& thread : _threads)
+	{
+		thread.join();
+	}
+
+	_threads.clear();
+}
+
+size_t SubscriptionDispatcher::ThreadCount() const noexcept
+{
+	return _threads.size();
+}
+
+void SubscriptionDispatcher::Run()
+{
+	while (true)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		_condition.wait(lock, [this]() noexcept -> bool {
+			return _stopped || !_ready.empty();
+		});
+
+		if (_ready.empty())
+		{
+			// Only reachable once we've been stopped and the ready-list is drained.
+			return;
+		}
+
+		auto target = std::move(_ready.front());
+
+		_ready.pop_front();
+		lock.unlock();
+
+		target->Dispatch();
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef SUBSCRIPTIONDISPATCHER_H
+#define SUBSCRIPTIONDISPATCHER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Multiplexes every open subscription onto a small, fixed number of dispatcher threads. A
+// subscription callback marks its target ready, and the next free dispatcher thread drains,
+// serializes and forwards whatever has accumulated for it. Idle subscriptions cost nothing but
+// their queue, regardless of how many of them are open.
+class SubscriptionDispatcher
+{
+public:
+	class Target
+	{
+	public:
+		virtual ~Target() = default;
+
+		// Called on a dispatcher thread some time after MarkReady. The target is responsible for
+		// not calling MarkReady again until Dispatch has drained it, which also guarantees that
+		// only one dispatcher thread works on it at a time and the payloads stay in order.
+		virtual void Dispatch() noexcept = 0;
+	};
+
+	static constexpr size_t DefaultThreadCount = 1;
+
+	explicit SubscriptionDispatcher(size_t threadCount);
+	~SubscriptionDispatcher();
+
+	void MarkReady(std::shared_ptr<Target> target);
+
+	// Dispatch any targets which are already on the ready-list and join all of the threads.
+	void Stop();
+
+	size_t ThreadCount() const noexcept;
+
+private:
+	void Run();
+
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	std::deque<std::shared_ptr<Target>> _ready;
+	bool _stopped = false;
+
+	std::vector<std::thread> _threads;
+};
+
+#endif // SUBSCRIPTIONDISPATCHER_H
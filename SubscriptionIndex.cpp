@@ -0,0 +1,157 @@
+#include "SubscriptionIndex.h"
+
+#include "graphqlservice/internal/Base64.h"
+
+#include <mutex>
+
+using namespace graphql;
+
+SubscriptionIndex::Pending::Pending(SubscriptionIndex& index, std::string_view field)
+	: _index { index }
+	, _field { field }
+{
+	std::unique_lock<std::shared_mutex> lock(_index._mutex);
+
+	++_index._pending[_field];
+}
+
+SubscriptionIndex::Pending::~Pending()
+{
+	std::unique_lock<std::shared_mutex> lock(_index._mutex);
+	const auto itr = _index._pending.find(_field);
+
+	if (itr != _index._pending.end() && --itr->second == 0)
+	{
+		_index._pending.erase(itr);
+	}
+}
+
+void SubscriptionIndex::Add(
+	std::string_view field, std::vector<response::IdType>&& ids, service::SubscriptionKey key)
+{
+	std::unique_lock<std::shared_mutex> lock(_mutex);
+	auto& indexKeys = _keys[key];
+
+	for (auto& id : ids)
+	{
+		IndexKey indexKey { std::string { field }, std::move(id) };
+
+		_subscriptions[indexKey].insert(key);
+		indexKeys.push_back(std::move(indexKey));
+	}
+}
+
+void SubscriptionIndex::AddUnindexed(std::string_view field, service::SubscriptionKey key)
+{
+	std::unique_lock<std::shared_mutex> lock(_mutex);
+	const auto itr = _unindexed.find(field);
+
+	if (itr == _unindexed.end())
+	{
+		_unindexed.emplace(std::string { field }, std::set<service::SubscriptionKey> { key });
+	}
+	else
+	{
+		itr->second.insert(key);
+	}
+
+	_unindexedKeys.emplace(key, std::string { field });
+}
+
+void SubscriptionIndex::Remove(service::SubscriptionKey key)
+{
+	std::unique_lock<std::shared_mutex> lock(_mutex);
+	const auto itrKeys = _keys.find(key);
+
+	if (itrKeys != _keys.end())
+	{
+		for (const auto& indexKey : itrKeys->second)
+		{
+			const auto itr = _subscriptions.find(indexKey);
+
+			if (itr != _subscriptions.end())
+			{
+				itr->second.erase(key);
+
+				if (itr->second.empty())
+				{
+					_subscriptions.erase(itr);
+				}
+			}
+		}
+
+		_keys.erase(itrKeys);
+	}
+
+	const auto itrUnindexed = _unindexedKeys.find(key);
+
+	if (itrUnindexed != _unindexedKeys.end())
+	{
+		const auto itr = _unindexed.find(itrUnindexed->second);
+
+		if (itr != _unindexed.end())
+		{
+			itr->second.erase(key);
+
+			if (itr->second.empty())
+			{
+				_unindexed.erase(itr);
+			}
+		}
+
+		_unindexedKeys.erase(itrUnindexed);
+	}
+}
+
+void SubscriptionIndex::Clear()
+{
+	std::unique_lock<std::shared_mutex> lock(_mutex);
+
+	_subscriptions.clear();
+	_unindexed.clear();
+	_pending.clear();
+	_keys.clear();
+	_unindexedKeys.clear();
+}
+
+std::optional<std::vector<service::SubscriptionKey>> SubscriptionIndex::Find(
+	std::string_view field, const response::IdType& id) const
+{
+	std::shared_lock<std::shared_mutex> lock(_mutex);
+
+	if (_unindexed.find(field) != _unindexed.end() || _pending.find(field) != _pending.end())
+	{
+		return std::nullopt;
+	}
+
+	std::vector<service::SubscriptionKey> result;
+	const auto itr = _subscriptions.find(IndexKey { std::string { field }, id });
+
+	if (itr != _subscriptions.end())
+	{
+		result.assign(itr->second.cbegin(), itr->second.cend());
+	}
+
+	return std::make_optional(std::move(result));
+}
+
+std::optional<response::IdType> SubscriptionIndex::ToId(const response::Value& value)
+{
+	switch (value.type())
+	{
+		case response::Type::ID:
+			return std::make_optional(response::IdType { value.get<response::IdType>() });
+
+		case response::Type::String:
+		{
+			const auto& text = value.get<response::StringType>();
+
+			return std::make_optional(internal::Base64::validateBase64(text)
+					? response::IdType { internal::Base64::fromBase64(text) }
+					: response::IdType { std::string { text } });
+		}
+
+		default:
+			return std::nullopt;
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#ifndef SUBSCRIPTIONINDEX_H
+#define SUBSCRIPTIONINDEX_H
+
+#include "graphqlservice/GraphQLService.h"
+
+#include <map>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Index from (subscription field, id argument) to the subscriptions which are listening for it, so
+// delivering a change to one node only touches the subscriptions for that node instead of testing
+// the filter against every subscription on the field. Subscriptions whose argument can't be
+// determined up front are tracked as unindexed, and while there are any on a field, Find defers to
+// the filtered delivery for everything on that field.
+class SubscriptionIndex
+{
+public:
+	// Find defers to the filtered delivery for the field while this is in scope, so an event which
+	// is delivered after the service subscribes but before the key is added still reaches the new
+	// subscription.
+	class Pending
+	{
+	public:
+		Pending(SubscriptionIndex& index, std::string_view field);
+		~Pending();
+
+		Pending(const Pending&) = delete;
+		Pending& operator=(const Pending&) = delete;
+
+	private:
+		SubscriptionIndex& _index;
+		const std::string _field;
+	};
+
+	void Add(std::string_view field, std::vector<graphql::response::IdType>&& ids,
+		graphql::service::SubscriptionKey key);
+	void AddUnindexed(std::string_view field, graphql::service::SubscriptionKey key);
+	void Remove(graphql::service::SubscriptionKey key);
+	void Clear();
+
+	// Returns std::nullopt if there are unindexed or pending subscriptions on the field.
+	std::optional<std::vector<graphql::service::SubscriptionKey>> Find(
+		std::string_view field, const graphql::response::IdType& id) const;
+
+	// Accepts the same forms the service accepts for an ID argument: a binary ID, or a string
+	// which is decoded from base64 if it's valid base64 and used as an opaque string otherwise.
+	static std::optional<graphql::response::IdType> ToId(const graphql::response::Value& value);
+
+private:
+	using IndexKey = std::pair<std::string, graphql::response::IdType>;
+
+	mutable std::shared_mutex _mutex;
+	std::map<IndexKey, std::set<graphql::service::SubscriptionKey>> _subscriptions;
+	std::map<std::string, std::set<graphql::service::SubscriptionKey>, std::less<>> _unindexed;
+	std::map<std::string, size_t, std::less<>> _pending;
+
+	// Reverse lookup so Remove doesn't need to know the field or ids.
+	std::map<graphql::service::SubscriptionKey, std::vector<IndexKey>> _keys;
+	std::map<graphql::service::SubscriptionKey, std::string> _unindexedKeys;
+};
+
+#endif // SUBSCRIPTIONINDEX_H
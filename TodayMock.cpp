@@ -11,13 +11,241 @@
 #include "TaskConnectionObject.h"
 #include "UnionTypeObject.h"
 
+#include "graphqlservice/internal/Base64.h"
+
 #include <algorithm>
 #include <chrono>
+#include <cstdint>
 #include <future>
 #include <iostream>
+#include <string_view>
+#include <type_traits>
 
 namespace graphql::today {
 
+std::optional<response::IdType> NormalizeId(const response::IdType& id)
+{
+	if (id.isBase64())
+	{
+		return std::nullopt;
+	}
+
+	const auto& text = id.get<response::IdType::OpaqueString>();
+
+	if (!internal::Base64::validateBase64(text))
+	{
+		return std::nullopt;
+	}
+
+	return std::make_optional<response::IdType>(internal::Base64::fromBase64(text));
+}
+
+size_t HashId(const response::IdType& id) noexcept
+{
+	if (id.isBase64())
+	{
+		const auto& bytes = id.get<response::IdType::ByteData>();
+
+		return std::hash<std::string_view> {}(
+			std::string_view { reinterpret_cast<const char*>(bytes.data()), bytes.size() });
+	}
+
+	return std::hash<std::string_view> {}(id.get<response::IdType::OpaqueString>());
+}
+
+// EntityStore::TypeOf depends on the order of the alternatives.
+static_assert(std::is_same_v<
+	std::variant_alternative_t<static_cast<size_t>(NodeType::Appointment), EntityStore::Entity>,
+	std::shared_ptr<Appointment>>);
+static_assert(std::is_same_v<
+	std::variant_alternative_t<static_cast<size_t>(NodeType::Task), EntityStore::Entity>,
+	std::shared_ptr<Task>>);
+static_assert(std::is_same_v<
+	std::variant_alternative_t<static_cast<size_t>(NodeType::Folder), EntityStore::Entity>,
+	std::shared_ptr<Folder>>);
+
+void EntityStore::Add(const std::vector<std::shared_ptr<Appointment>>& appointments)
+{
+	std::unique_lock lock(_mutex);
+
+	_entities.reserve(_entities.size() + appointments.size());
+
+	for (const auto& appointment : appointments)
+	{
+		Add(appointment->id(), appointment);
+	}
+}
+
+void EntityStore::Add(const std::vector<std::shared_ptr<Task>>& tasks)
+{
+	std::unique_lock lock(_mutex);
+
+	_entities.reserve(_entities.size() + tasks.size());
+
+	for (const auto& task : tasks)
+	{
+		Add(task->id(), task);
+	}
+}
+
+void EntityStore::Add(const std::vector<std::shared_ptr<Folder>>& folders)
+{
+	std::unique_lock lock(_mutex);
+
+	_entities.reserve(_entities.size() + folders.size());
+
+	for (const auto& folder : folders)
+	{
+		Add(folder->id(), folder);
+	}
+}
+
+std::optional<EntityStore::Entity> EntityStore::Find(const response::IdType& id) const
+{
+	const auto normalized = NormalizeId(id);
+	const auto& key = normalized ? *normalized : id;
+	std::shared_lock lock(_mutex);
+	const auto itr = _entities.find(KeyView { HashId(key), key });
+
+	return itr == _entities.end() ? std::nullopt : std::make_optional(itr->second);
+}
+
+size_t EntityStore::size() const
+{
+	std::shared_lock lock(_mutex);
+
+	return _entities.size();
+}
+
+// Expects the caller to hold the lock. The first entity with each id wins, like the scans did.
+void EntityStore::Add(response::IdType id, Entity&& entity)
+{
+	if (auto normalized = NormalizeId(id))
+	{
+		id = std::move(*normalized);
+	}
+
+	const auto hash = HashId(id);
+
+	_entities.emplace(Key { hash, std::move(id) }, std::move(entity));
+}
+
+namespace {
+
+// Tag byte, version, position, and a flag for whether the id is bytes or an opaque string, followed
+// by the id itself.
+constexpr std::uint8_t s_cursorTag = 0xC1;
+constexpr size_t s_cursorHeaderSize = 1 + 8 + 8 + 1;
+
+void appendUInt64(response::IdType::ByteData& bytes, std::uint64_t value)
+{
+	for (int i = 0; i < 8; ++i)
+	{
+		bytes.push_back(static_cast<std::uint8_t>(value >> (i * 8)));
+	}
+}
+
+std::uint64_t readUInt64(const std::uint8_t* bytes)
+{
+	std::uint64_t value = 0;
+
+	for (int i = 0; i < 8; ++i)
+	{
+		value |= static_cast<std::uint64_t>(bytes[i]) << (i * 8);
+	}
+
+	return value;
+}
+
+} // namespace
+
+response::Value ItemCursor::Encode() const
+{
+	response::IdType::ByteData bytes;
+
+	bytes.push_back(s_cursorTag);
+	appendUInt64(bytes, version);
+	appendUInt64(bytes, position);
+
+	if (id.isBase64())
+	{
+		const auto& idBytes = id.get<response::IdType::ByteData>();
+
+		bytes.reserve(bytes.size() + 1 + idBytes.size());
+		bytes.push_back(0);
+		bytes.insert(bytes.end(), idBytes.cbegin(), idBytes.cend());
+	}
+	else
+	{
+		const auto& idText = id.get<response::IdType::OpaqueString>();
+
+		bytes.reserve(bytes.size() + 1 + idText.size());
+		bytes.push_back(1);
+		bytes.insert(bytes.end(), idText.cbegin(), idText.cend());
+	}
+
+	return response::Value(response::IdType { std::move(bytes) });
+}
+
+std::optional<ItemCursor> ItemCursor::Decode(response::Value&& value)
+{
+	response::IdType::ByteData bytes;
+
+	switch (value.type())
+	{
+		case response::Type::ID:
+		{
+			auto id = value.release<response::IdType>();
+
+			if (!id.isBase64())
+			{
+				return std::make_optional(ItemCursor { 0, 0, std::move(id) });
+			}
+
+			bytes = id.release<response::IdType::ByteData>();
+			break;
+		}
+
+		case response::Type::String:
+		{
+			auto text = value.release<response::StringType>();
+
+			if (!internal::Base64::validateBase64(text))
+			{
+				return std::make_optional(
+					ItemCursor { 0, 0, response::IdType { std::move(text) } });
+			}
+
+			bytes = internal::Base64::fromBase64(text);
+			break;
+		}
+
+		default:
+			return std::nullopt;
+	}
+
+	if (bytes.size() < s_cursorHeaderSize || bytes.front() != s_cursorTag
+		|| bytes[s_cursorHeaderSize - 1] > 1)
+	{
+		// Just the id of the node.
+		return std::make_optional(ItemCursor { 0, 0, response::IdType { std::move(bytes) } });
+	}
+
+	ItemCursor cursor { readUInt64(bytes.data() + 1), readUInt64(bytes.data() + 9) };
+	const auto idBegin = bytes.cbegin() + s_cursorHeaderSize;
+
+	if (bytes[s_cursorHeaderSize - 1] == 0)
+	{
+		cursor.id = response::IdType { response::IdType::ByteData { idBegin, bytes.cend() } };
+	}
+	else
+	{
+		cursor.id = response::IdType { response::IdType::OpaqueString { idBegin, bytes.cend() } };
+	}
+
+	return std::make_optional(std::move(cursor));
+}
+
 Appointment::Appointment(
 	response::IdType&& id, std::string&& when, std::string&& subject, bool isNow)
 	: _id(std::move(id))
@@ -42,27 +270,30 @@ Folder::Folder(response::IdType&& id, std::string&& name, int unreadCount)
 }
 
 Query::Query(appointmentsLoader&& getAppointments, tasksLoader&& getTasks,
-	unreadCountsLoader&& getUnreadCounts)
+	unreadCountsLoader&& getUnreadCounts, nodeTypeLookup&& getNodeType)
 	: _getAppointments(std::move(getAppointments))
 	, _getTasks(std::move(getTasks))
 	, _getUnreadCounts(getUnreadCounts)
+	, _getNodeType(std::move(getNodeType))
 {
 }
 
 void Query::loadAppointments(const std::shared_ptr<service::RequestState>& state)
 {
+	std::lock_guard lock(_loadMutex);
+
 	if (_getAppointments)
 	{
-		if (state)
+		// Other callers pass their own kind of RequestState.
+		if (auto todayState = std::dynamic_pointer_cast<RequestState>(state))
 		{
-			auto todayState = std::static_pointer_cast<RequestState>(state);
-
 			todayState->appointmentsRequestId = todayState->requestId;
 			todayState->loadAppointmentsCount++;
 		}
 
-		_appointments = _getAppointments();
+		_appointments = std::make_shared<const ConnectionList<Appointment>>(_getAppointments());
 		_getAppointments = nullptr;
+		_entities.Add(_appointments->objects());
 	}
 }
 
@@ -71,31 +302,25 @@ std::shared_ptr<Appointment> Query::findAppointment(
 {
 	loadAppointments(params.state);
 
-	for (const auto& appointment : _appointments)
-	{
-		if (appointment->id() == id)
-		{
-			return appointment;
-		}
-	}
-
-	return nullptr;
+	return _entities.Find<Appointment>(id);
 }
 
 void Query::loadTasks(const std::shared_ptr<service::RequestState>& state)
 {
+	std::lock_guard lock(_loadMutex);
+
 	if (_getTasks)
 	{
-		if (state)
+		// Other callers pass their own kind of RequestState.
+		if (auto todayState = std::dynamic_pointer_cast<RequestState>(state))
 		{
-			auto todayState = std::static_pointer_cast<RequestState>(state);
-
 			todayState->tasksRequestId = todayState->requestId;
 			todayState->loadTasksCount++;
 		}
 
-		_tasks = _getTasks();
+		_tasks = std::make_shared<const ConnectionList<Task>>(_getTasks());
 		_getTasks = nullptr;
+		_entities.Add(_tasks->objects());
 	}
 }
 
@@ -104,31 +329,25 @@ std::shared_ptr<Task> Query::findTask(
 {
 	loadTasks(params.state);
 
-	for (const auto& task : _tasks)
-	{
-		if (task->id() == id)
-		{
-			return task;
-		}
-	}
-
-	return nullptr;
+	return _entities.Find<Task>(id);
 }
 
 void Query::loadUnreadCounts(const std::shared_ptr<service::RequestState>& state)
 {
+	std::lock_guard lock(_loadMutex);
+
 	if (_getUnreadCounts)
 	{
-		if (state)
+		// Other callers pass their own kind of RequestState.
+		if (auto todayState = std::dynamic_pointer_cast<RequestState>(state))
 		{
-			auto todayState = std::static_pointer_cast<RequestState>(state);
-
 			todayState->unreadCountsRequestId = todayState->requestId;
 			todayState->loadUnreadCountsCount++;
 		}
 
-		_unreadCounts = _getUnreadCounts();
+		_unreadCounts = std::make_shared<const ConnectionList<Folder>>(_getUnreadCounts());
 		_getUnreadCounts = nullptr;
+		_entities.Add(_unreadCounts->objects());
 	}
 }
 
@@ -137,15 +356,26 @@ std::shared_ptr<Folder> Query::findUnreadCount(
 {
 	loadUnreadCounts(params.state);
 
-	for (const auto& folder : _unreadCounts)
+	return _entities.Find<Folder>(id);
+}
+
+void Query::loadNodes(
+	const std::shared_ptr<service::RequestState>& state, std::optional<NodeType> type)
+{
+	if (!type || *type == NodeType::Appointment)
 	{
-		if (folder->id() == id)
-		{
-			return folder;
-		}
+		loadAppointments(state);
 	}
 
-	return nullptr;
+	if (!type || *type == NodeType::Task)
+	{
+		loadTasks(state);
+	}
+
+	if (!type || *type == NodeType::Folder)
+	{
+		loadUnreadCounts(state);
+	}
 }
 
 template <class _Rep, class _Period>
@@ -181,27 +411,37 @@ service::AwaitableObject<std::shared_ptr<object::Node>> Query::getNode(
 	using namespace std::literals;
 	co_await 100ms;
 
-	auto appointment = findAppointment(params, id);
+	// With an index of the nodes, only the list which owns the id is loaded. Either way there's a
+	// single lookup in the EntityStore, and the type it recorded picks the object which wraps it.
+	const auto type = _getNodeType ? _getNodeType(id) : std::nullopt;
 
-	if (appointment)
+	if (_getNodeType && !type)
 	{
-		co_return std::make_shared<object::Node>(
-			std::make_shared<object::Appointment>(std::move(appointment)));
+		co_return nullptr;
 	}
 
-	auto task = findTask(params, id);
+	loadNodes(params.state, type);
+
+	auto entity = _entities.Find(id);
 
-	if (task)
+	if (!entity)
 	{
-		co_return std::make_shared<object::Node>(std::make_shared<object::Task>(std::move(task)));
+		co_return nullptr;
 	}
 
-	auto folder = findUnreadCount(params, id);
-
-	if (folder)
+	switch (EntityStore::TypeOf(*entity))
 	{
-		co_return std::make_shared<object::Node>(
-			std::make_shared<object::Folder>(std::move(folder)));
+		case NodeType::Appointment:
+			co_return std::make_shared<object::Node>(std::make_shared<object::Appointment>(
+				std::get<std::shared_ptr<Appointment>>(std::move(*entity))));
+
+		case NodeType::Task:
+			co_return std::make_shared<object::Node>(std::make_shared<object::Task>(
+				std::get<std::shared_ptr<Task>>(std::move(*entity))));
+
+		case NodeType::Folder:
+			co_return std::make_shared<object::Node>(std::make_shared<object::Folder>(
+				std::get<std::shared_ptr<Folder>>(std::move(*entity))));
 	}
 
 	co_return nullptr;
@@ -210,48 +450,43 @@ service::AwaitableObject<std::shared_ptr<object::Node>> Query::getNode(
 template <class _Object, class _Connection>
 struct EdgeConstraints
 {
-	using vec_type = std::vector<std::shared_ptr<_Object>>;
-	using itr_type = typename vec_type::const_iterator;
+	using list_type = ConnectionList<_Object>;
 
-	EdgeConstraints(const std::shared_ptr<service::RequestState>& state, const vec_type& objects)
+	EdgeConstraints(const std::shared_ptr<service::RequestState>& state,
+		const std::shared_ptr<const list_type>& objects)
 		: _state(state)
 		, _objects(objects)
 	{
 	}
 
+	// The after and before edges are both included in the page, like they were when the cursors
+	// were just the id of the node. A cursor which isn't in the list is ignored.
 	std::shared_ptr<_Connection> operator()(const std::optional<int>& first,
 		std::optional<response::Value>&& after, const std::optional<int>& last,
 		std::optional<response::Value>&& before) const
 	{
-		auto itrFirst = _objects.cbegin();
-		auto itrLast = _objects.cend();
+		size_t positionFirst = 0;
+		size_t positionLast = _objects->size();
 
 		if (after)
 		{
-			auto afterId = after->release<response::IdType>();
-			auto itrAfter =
-				std::find_if(itrFirst, itrLast, [&afterId](const std::shared_ptr<_Object>& entry) {
-					return entry->id() == afterId;
-				});
-
-			if (itrAfter != itrLast)
+			if (auto cursor = ItemCursor::Decode(std::move(*after)))
 			{
-				itrFirst = itrAfter;
+				if (auto position = _objects->Seek(*cursor, positionFirst))
+				{
+					positionFirst = *position;
+				}
 			}
 		}
 
 		if (before)
 		{
-			auto beforeId = before->release<response::IdType>();
-			auto itrBefore =
-				std::find_if(itrFirst, itrLast, [&beforeId](const std::shared_ptr<_Object>& entry) {
-					return entry->id() == beforeId;
-				});
-
-			if (itrBefore != itrLast)
+			if (auto cursor = ItemCursor::Decode(std::move(*before)))
 			{
-				itrLast = itrBefore;
-				++itrLast;
+				if (auto position = _objects->Seek(*cursor, positionFirst))
+				{
+					positionLast = *position + 1;
+				}
 			}
 		}
 
@@ -265,9 +500,9 @@ struct EdgeConstraints
 				throw service::schema_exception { { service::schema_error { error.str() } } };
 			}
 
-			if (itrLast - itrFirst > *first)
+			if (positionLast - positionFirst > static_cast<size_t>(*first))
 			{
-				itrLast = itrFirst + *first;
+				positionLast = positionFirst + static_cast<size_t>(*first);
 			}
 		}
 
@@ -281,23 +516,18 @@ struct EdgeConstraints
 				throw service::schema_exception { { service::schema_error { error.str() } } };
 			}
 
-			if (itrLast - itrFirst > *last)
+			if (positionLast - positionFirst > static_cast<size_t>(*last))
 			{
-				itrFirst = itrLast - *last;
+				positionFirst = positionLast - static_cast<size_t>(*last);
 			}
 		}
 
-		std::vector<std::shared_ptr<_Object>> edges(itrLast - itrFirst);
-
-		std::copy(itrFirst, itrLast, edges.begin());
-
-		return std::make_shared<_Connection>(itrLast<_objects.cend(), itrFirst> _objects.cbegin(),
-			std::move(edges));
+		return std::make_shared<_Connection>(_objects, positionFirst, positionLast);
 	}
 
 private:
 	const std::shared_ptr<service::RequestState>& _state;
-	const vec_type& _objects;
+	const std::shared_ptr<const list_type>& _objects;
 };
 
 std::future<std::shared_ptr<object::AppointmentConnection>> Query::getAppointments(
@@ -459,10 +689,11 @@ std::vector<std::shared_ptr<object::UnionType>> Query::getAnyType(
 {
 	loadAppointments(params.state);
 
-	std::vector<std::shared_ptr<object::UnionType>> result(_appointments.size());
+	const auto& appointments = _appointments->objects();
+	std::vector<std::shared_ptr<object::UnionType>> result(appointments.size());
 
-	std::transform(_appointments.cbegin(),
-		_appointments.cend(),
+	std::transform(appointments.cbegin(),
+		appointments.cend(),
 		result.begin(),
 		[](const auto& appointment) noexcept {
 			return std::make_shared<object::UnionType>(
@@ -478,9 +709,10 @@ Mutation::Mutation(completeTaskMutation&& mutateCompleteTask)
 }
 
 std::shared_ptr<object::CompleteTaskPayload> Mutation::applyCompleteTask(
-	CompleteTaskInput&& input) noexcept
+	service::FieldParams&& params, CompleteTaskInput&& input) noexcept
 {
-	return std::make_shared<object::CompleteTaskPayload>(_mutateCompleteTask(std::move(input)));
+	return std::make_shared<object::CompleteTaskPayload>(
+		_mutateCompleteTask(params.state, std::move(input)));
 }
 
 std::optional<double> Mutation::_setFloat = std::nullopt;
@@ -20,9 +20,17 @@
 #include "TaskEdgeObject.h"
 #include "TaskObject.h"
 
+#include <algorithm>
 #include <atomic>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <shared_mutex>
 #include <stack>
+#include <unordered_map>
+#include <variant>
 
 namespace graphql::today {
 
@@ -44,20 +52,305 @@ struct RequestState : service::RequestState
 	size_t loadUnreadCountsCount = 0;
 };
 
+// Implemented by request states which observe the objects a request resolves, e.g. to tag a cached
+// response with the nodes it read, or to record when each object is resolved for the tracing
+// extension. The hooks are called on whichever thread resolves the object, and only if the flag
+// for them is set.
+struct RequestObserver
+{
+	explicit RequestObserver(bool trackNodes, bool traceSelectionSets) noexcept
+		: trackNodes { trackNodes }
+		, traceSelectionSets { traceSelectionSets }
+	{
+		if (trackNodes || traceSelectionSets)
+		{
+			s_activeCount.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	virtual ~RequestObserver()
+	{
+		if (trackNodes || traceSelectionSets)
+		{
+			s_activeCount.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	virtual void TrackNode(const response::IdType&)
+	{
+	}
+
+	virtual void BeginSelectionSet(std::string_view, const service::SelectionSetParams&)
+	{
+	}
+
+	virtual void EndSelectionSet(const service::SelectionSetParams&)
+	{
+	}
+
+	const bool trackNodes;
+	const bool traceSelectionSets;
+
+	// Observers with either flag set which are still alive. While there are none, which is the
+	// common case, the resolvers skip the dynamic_cast to look for one.
+	static inline std::atomic<size_t> s_activeCount { 0 };
+};
+
+inline RequestObserver* findObserver(const service::SelectionSetParams& params) noexcept
+{
+	if (RequestObserver::s_activeCount.load(std::memory_order_relaxed) == 0)
+	{
+		return nullptr;
+	}
+
+	return dynamic_cast<RequestObserver*>(params.state.get());
+}
+
+// Gives an object the beginSelectionSet and endSelectionSet hooks which report it to the
+// RequestObserver, as T::TypeName, and track its id if it has one.
+template <class T>
+class ObservedSelectionSet
+{
+public:
+	void beginSelectionSet(const service::SelectionSetParams& params) const
+	{
+		const auto observer = findObserver(params);
+
+		if (!observer)
+		{
+			return;
+		}
+
+		if constexpr (requires(const T& self) { self.id(); })
+		{
+			if (observer->trackNodes)
+			{
+				observer->TrackNode(static_cast<const T&>(*this).id());
+			}
+		}
+
+		if (observer->traceSelectionSets)
+		{
+			observer->BeginSelectionSet(T::TypeName, params);
+		}
+	}
+
+	void endSelectionSet(const service::SelectionSetParams& params) const
+	{
+		const auto observer = findObserver(params);
+
+		if (observer && observer->traceSelectionSets)
+		{
+			observer->EndSelectionSet(params);
+		}
+	}
+};
+
 class Appointment;
 class Task;
 class Folder;
 class Expensive;
 
-class Query : public std::enable_shared_from_this<Query>
+// An opaque string which is valid base64 is normalized to the bytes it encodes, so an id matches
+// however it was passed in. Returns nullopt if the id is already bytes or isn't base64.
+std::optional<response::IdType> NormalizeId(const response::IdType& id);
+
+// Hashes the bytes or the opaque string, whichever the id holds. Normalize the id first if the
+// other form should hash the same.
+size_t HashId(const response::IdType& id) noexcept;
+
+// The types which implement Node, i.e. which list an id belongs to.
+enum class NodeType : std::uint8_t
+{
+	Appointment,
+	Task,
+	Folder,
+};
+
+// Hash index of every Appointment, Task and Folder by id, so node(id:) and the *ById fields find
+// each entity in O(1) instead of scanning the lists. The hash of each id is computed once when the
+// entity is added and stored with it, and once for each lookup. Safe to call from any thread.
+class EntityStore
 {
 public:
+	// The alternatives are in NodeType order, so the index of the one an entity holds is the type
+	// of node it was added as.
+	using Entity =
+		std::variant<std::shared_ptr<Appointment>, std::shared_ptr<Task>, std::shared_ptr<Folder>>;
+
+	static NodeType TypeOf(const Entity& entity) noexcept
+	{
+		return static_cast<NodeType>(entity.index());
+	}
+
+	void Add(const std::vector<std::shared_ptr<Appointment>>& appointments);
+	void Add(const std::vector<std::shared_ptr<Task>>& tasks);
+	void Add(const std::vector<std::shared_ptr<Folder>>& folders);
+
+	std::optional<Entity> Find(const response::IdType& id) const;
+
+	// Returns nullptr if there's no entity with that id, or it's a different type.
+	template <class T>
+	std::shared_ptr<T> Find(const response::IdType& id) const
+	{
+		const auto entity = Find(id);
+		const auto result = entity ? std::get_if<std::shared_ptr<T>>(&*entity) : nullptr;
+
+		return result ? *result : nullptr;
+	}
+
+	size_t size() const;
+
+private:
+	struct Key
+	{
+		size_t hash;
+		response::IdType id;
+	};
+
+	struct KeyView
+	{
+		size_t hash;
+		const response::IdType& id;
+	};
+
+	struct KeyHash
+	{
+		using is_transparent = void;
+
+		size_t operator()(const Key& key) const noexcept
+		{
+			return key.hash;
+		}
+
+		size_t operator()(const KeyView& key) const noexcept
+		{
+			return key.hash;
+		}
+	};
+
+	struct KeyEqual
+	{
+		using is_transparent = void;
+
+		template <class L, class R>
+		bool operator()(const L& lhs, const R& rhs) const noexcept
+		{
+			return lhs.hash == rhs.hash && lhs.id == rhs.id;
+		}
+	};
+
+	// Ids are stored and looked up after NormalizeId.
+	void Add(response::IdType id, Entity&& entity);
+
+	mutable std::shared_mutex _mutex;
+	std::unordered_map<Key, Entity, KeyHash, KeyEqual> _entities;
+};
+
+// Opaque cursor for the connections. It encodes the version of the list it was taken from, the
+// position of the edge in that list, and the id of the node, which is the key the list is searched
+// by when the position can't be trusted.
+struct ItemCursor
+{
+	std::uint64_t version = 0;
+	std::uint64_t position = 0;
+	response::IdType id;
+
+	response::Value Encode() const;
+
+	// A cursor which is only an id, e.g. from before cursors encoded a position, decodes with
+	// version 0, which never matches a list. Returns std::nullopt if it isn't an ID at all.
+	static std::optional<ItemCursor> Decode(response::Value&& value);
+};
+
+// Every ConnectionList gets a new version, so a cursor from a list which has since been reloaded
+// is recognized as stale.
+inline std::atomic<std::uint64_t> s_connectionListVersion { 0 };
+
+// One of the lists behind the connections in Query, in the order it was loaded, plus the positions
+// sorted by id. It's immutable once it's built, so every connection taken from it shares it and
+// only keeps the range of positions it covers.
+template <class T>
+class ConnectionList
+{
+public:
+	explicit ConnectionList(std::vector<std::shared_ptr<T>>&& objects)
+		: _objects(std::move(objects))
+		, _version(++s_connectionListVersion)
+		, _byId(_objects.size())
+	{
+		std::iota(_byId.begin(), _byId.end(), size_t { 0 });
+		std::stable_sort(_byId.begin(), _byId.end(), [this](size_t lhs, size_t rhs) {
+			return _objects[lhs]->id() < _objects[rhs]->id();
+		});
+	}
+
+	const std::vector<std::shared_ptr<T>>& objects() const noexcept
+	{
+		return _objects;
+	}
+
+	size_t size() const noexcept
+	{
+		return _objects.size();
+	}
+
+	ItemCursor CursorAt(size_t position) const
+	{
+		return ItemCursor { _version, position, _objects[position]->id() };
+	}
+
+	// The first position at or after minPosition which holds the node the cursor points to. That's
+	// O(1) if the cursor came from this version of the list, and a binary search by id otherwise.
+	// Returns std::nullopt if the node isn't in the list.
+	std::optional<size_t> Seek(const ItemCursor& cursor, size_t minPosition) const
+	{
+		if (cursor.version == _version && cursor.position >= minPosition
+			&& cursor.position < _objects.size() && _objects[cursor.position]->id() == cursor.id)
+		{
+			return std::make_optional(static_cast<size_t>(cursor.position));
+		}
+
+		const auto itr = std::lower_bound(_byId.cbegin(),
+			_byId.cend(),
+			minPosition,
+			[this, &cursor](size_t position, size_t bound) {
+				const auto& id = _objects[position]->id();
+
+				return id < cursor.id || (id == cursor.id && position < bound);
+			});
+
+		if (itr == _byId.cend() || !(_objects[*itr]->id() == cursor.id))
+		{
+			return std::nullopt;
+		}
+
+		return std::make_optional(*itr);
+	}
+
+private:
+	const std::vector<std::shared_ptr<T>> _objects;
+	const std::uint64_t _version;
+	std::vector<size_t> _byId;
+};
+
+class Query
+	: public std::enable_shared_from_this<Query>
+	, public ObservedSelectionSet<Query>
+{
+public:
+	static constexpr std::string_view TypeName = "Query";
+
 	using appointmentsLoader = std::function<std::vector<std::shared_ptr<Appointment>>()>;
 	using tasksLoader = std::function<std::vector<std::shared_ptr<Task>>()>;
 	using unreadCountsLoader = std::function<std::vector<std::shared_ptr<Folder>>()>;
 
+	// Returns the type of node an id belongs to without loading any of the lists, or std::nullopt
+	// if it isn't a node, for callers which already keep an index of their nodes.
+	using nodeTypeLookup = std::function<std::optional<NodeType>(const response::IdType&)>;
+
 	explicit Query(appointmentsLoader&& getAppointments, tasksLoader&& getTasks,
-		unreadCountsLoader&& getUnreadCounts);
+		unreadCountsLoader&& getUnreadCounts, nodeTypeLookup&& getNodeType = {});
 
 	service::AwaitableObject<std::shared_ptr<object::Node>> getNode(
 		service::FieldParams params, response::IdType id);
@@ -97,18 +390,30 @@ private:
 	void loadTasks(const std::shared_ptr<service::RequestState>& state);
 	void loadUnreadCounts(const std::shared_ptr<service::RequestState>& state);
 
+	// Load the list which holds that type of node, or every list if the type isn't known.
+	void loadNodes(
+		const std::shared_ptr<service::RequestState>& state, std::optional<NodeType> type);
+
+	// Resolvers may run on several threads at once, and only the first one to need each list
+	// loads it.
+	std::mutex _loadMutex;
+
 	appointmentsLoader _getAppointments;
 	tasksLoader _getTasks;
 	unreadCountsLoader _getUnreadCounts;
+	const nodeTypeLookup _getNodeType;
 
-	std::vector<std::shared_ptr<Appointment>> _appointments;
-	std::vector<std::shared_ptr<Task>> _tasks;
-	std::vector<std::shared_ptr<Folder>> _unreadCounts;
+	std::shared_ptr<const ConnectionList<Appointment>> _appointments;
+	std::shared_ptr<const ConnectionList<Task>> _tasks;
+	std::shared_ptr<const ConnectionList<Folder>> _unreadCounts;
+	EntityStore _entities;
 };
 
-class PageInfo
+class PageInfo : public ObservedSelectionSet<PageInfo>
 {
 public:
+	static constexpr std::string_view TypeName = "PageInfo";
+
 	explicit PageInfo(bool hasNextPage, bool hasPreviousPage)
 		: _hasNextPage(hasNextPage)
 		, _hasPreviousPage(hasPreviousPage)
@@ -130,9 +435,11 @@ private:
 	const bool _hasPreviousPage;
 };
 
-class Appointment
+class Appointment : public ObservedSelectionSet<Appointment>
 {
 public:
+	static constexpr std::string_view TypeName = "Appointment";
+
 	explicit Appointment(
 		response::IdType&& id, std::string&& when, std::string&& subject, bool isNow);
 
@@ -174,35 +481,44 @@ private:
 	bool _isNow;
 };
 
-class AppointmentEdge
+class AppointmentEdge : public ObservedSelectionSet<AppointmentEdge>
 {
 public:
-	explicit AppointmentEdge(std::shared_ptr<Appointment> appointment)
-		: _appointment(std::move(appointment))
+	static constexpr std::string_view TypeName = "AppointmentEdge";
+
+	explicit AppointmentEdge(
+		std::shared_ptr<const ConnectionList<Appointment>> appointments, size_t position)
+		: _appointments(std::move(appointments))
+		, _position(position)
 	{
 	}
 
 	std::shared_ptr<object::Appointment> getNode() const noexcept
 	{
-		return std::make_shared<object::Appointment>(_appointment);
+		return std::make_shared<object::Appointment>(_appointments->objects()[_position]);
 	}
 
 	service::AwaitableScalar<response::Value> getCursor() const
 	{
-		co_return response::Value(co_await _appointment->getId());
+		return _appointments->CursorAt(_position).Encode();
 	}
 
 private:
-	std::shared_ptr<Appointment> _appointment;
+	std::shared_ptr<const ConnectionList<Appointment>> _appointments;
+	size_t _position;
 };
 
-class AppointmentConnection
+class AppointmentConnection : public ObservedSelectionSet<AppointmentConnection>
 {
 public:
-	explicit AppointmentConnection(bool hasNextPage, bool hasPreviousPage,
-		std::vector<std::shared_ptr<Appointment>> appointments)
-		: _pageInfo(std::make_shared<PageInfo>(hasNextPage, hasPreviousPage))
+	static constexpr std::string_view TypeName = "AppointmentConnection";
+
+	explicit AppointmentConnection(
+		std::shared_ptr<const ConnectionList<Appointment>> appointments, size_t first, size_t last)
+		: _pageInfo(std::make_shared<PageInfo>(last < appointments->size(), first > 0))
 		, _appointments(std::move(appointments))
+		, _first(first)
+		, _last(last)
 	{
 	}
 
@@ -213,28 +529,31 @@ public:
 
 	std::optional<std::vector<std::shared_ptr<object::AppointmentEdge>>> getEdges() const noexcept
 	{
-		auto result = std::make_optional<std::vector<std::shared_ptr<object::AppointmentEdge>>>(
-			_appointments.size());
+		auto result = std::make_optional<std::vector<std::shared_ptr<object::AppointmentEdge>>>();
 
-		std::transform(_appointments.cbegin(),
-			_appointments.cend(),
-			result->begin(),
-			[](const std::shared_ptr<Appointment>& node) {
-				return std::make_shared<object::AppointmentEdge>(
-					std::make_shared<AppointmentEdge>(node));
-			});
+		result->reserve(_last - _first);
+
+		for (auto position = _first; position < _last; ++position)
+		{
+			result->push_back(std::make_shared<object::AppointmentEdge>(
+				std::make_shared<AppointmentEdge>(_appointments, position)));
+		}
 
 		return result;
 	}
 
 private:
 	std::shared_ptr<PageInfo> _pageInfo;
-	std::vector<std::shared_ptr<Appointment>> _appointments;
+	std::shared_ptr<const ConnectionList<Appointment>> _appointments;
+	const size_t _first;
+	const size_t _last;
 };
 
-class Task
+class Task : public ObservedSelectionSet<Task>
 {
 public:
+	static constexpr std::string_view TypeName = "Task";
+
 	explicit Task(response::IdType&& id, std::string&& title, bool isComplete);
 
 	// EdgeConstraints accessor
@@ -265,35 +584,43 @@ private:
 	TaskState _state = TaskState::New;
 };
 
-class TaskEdge
+class TaskEdge : public ObservedSelectionSet<TaskEdge>
 {
 public:
-	explicit TaskEdge(std::shared_ptr<Task> task)
-		: _task(std::move(task))
+	static constexpr std::string_view TypeName = "TaskEdge";
+
+	explicit TaskEdge(std::shared_ptr<const ConnectionList<Task>> tasks, size_t position)
+		: _tasks(std::move(tasks))
+		, _position(position)
 	{
 	}
 
 	std::shared_ptr<object::Task> getNode() const noexcept
 	{
-		return std::make_shared<object::Task>(_task);
+		return std::make_shared<object::Task>(_tasks->objects()[_position]);
 	}
 
-	service::AwaitableScalar<response::Value> getCursor() const noexcept
+	service::AwaitableScalar<response::Value> getCursor() const
 	{
-		co_return response::Value(co_await _task->getId());
+		return _tasks->CursorAt(_position).Encode();
 	}
 
 private:
-	std::shared_ptr<Task> _task;
+	std::shared_ptr<const ConnectionList<Task>> _tasks;
+	size_t _position;
 };
 
-class TaskConnection
+class TaskConnection : public ObservedSelectionSet<TaskConnection>
 {
 public:
+	static constexpr std::string_view TypeName = "TaskConnection";
+
 	explicit TaskConnection(
-		bool hasNextPage, bool hasPreviousPage, std::vector<std::shared_ptr<Task>> tasks)
-		: _pageInfo(std::make_shared<PageInfo>(hasNextPage, hasPreviousPage))
+		std::shared_ptr<const ConnectionList<Task>> tasks, size_t first, size_t last)
+		: _pageInfo(std::make_shared<PageInfo>(last < tasks->size(), first > 0))
 		, _tasks(std::move(tasks))
+		, _first(first)
+		, _last(last)
 	{
 	}
 
@@ -304,27 +631,31 @@ public:
 
 	std::optional<std::vector<std::shared_ptr<object::TaskEdge>>> getEdges() const noexcept
 	{
-		auto result =
-			std::make_optional<std::vector<std::shared_ptr<object::TaskEdge>>>(_tasks.size());
+		auto result = std::make_optional<std::vector<std::shared_ptr<object::TaskEdge>>>();
 
-		std::transform(_tasks.cbegin(),
-			_tasks.cend(),
-			result->begin(),
-			[](const std::shared_ptr<Task>& node) {
-				return std::make_shared<object::TaskEdge>(std::make_shared<TaskEdge>(node));
-			});
+		result->reserve(_last - _first);
+
+		for (auto position = _first; position < _last; ++position)
+		{
+			result->push_back(
+				std::make_shared<object::TaskEdge>(std::make_shared<TaskEdge>(_tasks, position)));
+		}
 
 		return result;
 	}
 
 private:
 	std::shared_ptr<PageInfo> _pageInfo;
-	std::vector<std::shared_ptr<Task>> _tasks;
+	std::shared_ptr<const ConnectionList<Task>> _tasks;
+	const size_t _first;
+	const size_t _last;
 };
 
-class Folder
+class Folder : public ObservedSelectionSet<Folder>
 {
 public:
+	static constexpr std::string_view TypeName = "Folder";
+
 	explicit Folder(response::IdType&& id, std::string&& name, int unreadCount);
 
 	// EdgeConstraints accessor
@@ -354,35 +685,43 @@ private:
 	int _unreadCount;
 };
 
-class FolderEdge
+class FolderEdge : public ObservedSelectionSet<FolderEdge>
 {
 public:
-	explicit FolderEdge(std::shared_ptr<Folder> folder)
-		: _folder(std::move(folder))
+	static constexpr std::string_view TypeName = "FolderEdge";
+
+	explicit FolderEdge(std::shared_ptr<const ConnectionList<Folder>> folders, size_t position)
+		: _folders(std::move(folders))
+		, _position(position)
 	{
 	}
 
 	std::shared_ptr<object::Folder> getNode() const noexcept
 	{
-		return std::make_shared<object::Folder>(_folder);
+		return std::make_shared<object::Folder>(_folders->objects()[_position]);
 	}
 
-	service::AwaitableScalar<response::Value> getCursor() const noexcept
+	service::AwaitableScalar<response::Value> getCursor() const
 	{
-		co_return response::Value(co_await _folder->getId());
+		return _folders->CursorAt(_position).Encode();
 	}
 
 private:
-	std::shared_ptr<Folder> _folder;
+	std::shared_ptr<const ConnectionList<Folder>> _folders;
+	size_t _position;
 };
 
-class FolderConnection
+class FolderConnection : public ObservedSelectionSet<FolderConnection>
 {
 public:
+	static constexpr std::string_view TypeName = "FolderConnection";
+
 	explicit FolderConnection(
-		bool hasNextPage, bool hasPreviousPage, std::vector<std::shared_ptr<Folder>> folders)
-		: _pageInfo(std::make_shared<PageInfo>(hasNextPage, hasPreviousPage))
+		std::shared_ptr<const ConnectionList<Folder>> folders, size_t first, size_t last)
+		: _pageInfo(std::make_shared<PageInfo>(last < folders->size(), first > 0))
 		, _folders(std::move(folders))
+		, _first(first)
+		, _last(last)
 	{
 	}
 
@@ -393,27 +732,31 @@ public:
 
 	std::optional<std::vector<std::shared_ptr<object::FolderEdge>>> getEdges() const noexcept
 	{
-		auto result =
-			std::make_optional<std::vector<std::shared_ptr<object::FolderEdge>>>(_folders.size());
+		auto result = std::make_optional<std::vector<std::shared_ptr<object::FolderEdge>>>();
 
-		std::transform(_folders.cbegin(),
-			_folders.cend(),
-			result->begin(),
-			[](const std::shared_ptr<Folder>& node) {
-				return std::make_shared<object::FolderEdge>(std::make_shared<FolderEdge>(node));
-			});
+		result->reserve(_last - _first);
+
+		for (auto position = _first; position < _last; ++position)
+		{
+			result->push_back(std::make_shared<object::FolderEdge>(
+				std::make_shared<FolderEdge>(_folders, position)));
+		}
 
 		return result;
 	}
 
 private:
 	std::shared_ptr<PageInfo> _pageInfo;
-	std::vector<std::shared_ptr<Folder>> _folders;
+	std::shared_ptr<const ConnectionList<Folder>> _folders;
+	const size_t _first;
+	const size_t _last;
 };
 
-class CompleteTaskPayload
+class CompleteTaskPayload : public ObservedSelectionSet<CompleteTaskPayload>
 {
 public:
+	static constexpr std::string_view TypeName = "CompleteTaskPayload";
+
 	explicit CompleteTaskPayload(
 		std::shared_ptr<Task> task, std::optional<std::string>&& clientMutationId)
 		: _task(std::move(task))
@@ -439,15 +782,16 @@ private:
 class Mutation
 {
 public:
-	using completeTaskMutation =
-		std::function<std::shared_ptr<CompleteTaskPayload>(CompleteTaskInput&&)>;
+	// The RequestState is whatever the caller passed to resolve, so it can see per-request options.
+	using completeTaskMutation = std::function<std::shared_ptr<CompleteTaskPayload>(
+		const std::shared_ptr<service::RequestState>&, CompleteTaskInput&&)>;
 
 	explicit Mutation(completeTaskMutation&& mutateCompleteTask);
 
 	static double getFloat() noexcept;
 
 	std::shared_ptr<object::CompleteTaskPayload> applyCompleteTask(
-		CompleteTaskInput&& input) noexcept;
+		service::FieldParams&& params, CompleteTaskInput&& input) noexcept;
 	double applySetFloat(double valueArg) noexcept;
 
 private:
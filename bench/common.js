@@ -0,0 +1,98 @@
+// Shared helpers for the benchmark scripts in this directory. They load the native module directly,
+// so run them with Electron acting as Node, e.g.:
+//   cross-env ELECTRON_RUN_AS_NODE=1 electron bench/delivery.js
+const path = require("path");
+
+exports.parseArgs = function (defaults) {
+  const options = { ...defaults };
+  const argv = process.argv.slice(2);
+
+  for (let i = 0; i < argv.length; ++i) {
+    const match = /^--([^=]+)(?:=(.*))?$/.exec(argv[i]);
+
+    if (!match) {
+      throw new Error(`Unexpected argument: ${argv[i]}`);
+    }
+
+    const name = match[1];
+    const value = match[2] !== undefined ? match[2] : argv[++i];
+
+    options[name] = typeof defaults[name] === "number" ? Number(value) : value;
+  }
+
+  return options;
+};
+
+// Pass --module=<path> to compare against a build of another revision.
+exports.loadModule = function (modulePath) {
+  return modulePath
+    ? require(path.resolve(modulePath))
+    : require("bindings")("electron-cppgraphql.node");
+};
+
+exports.summarize = function (samples) {
+  const sorted = Float64Array.from(samples).sort();
+  const percentile = (p) =>
+    sorted.length === 0
+      ? 0
+      : sorted[Math.min(sorted.length - 1, Math.floor((p / 100) * sorted.length))];
+  const total = sorted.reduce((sum, value) => sum + value, 0);
+
+  return {
+    count: sorted.length,
+    mean: sorted.length === 0 ? 0 : total / sorted.length,
+    p50: percentile(50),
+    p99: percentile(99),
+    p999: percentile(99.9),
+    max: sorted.length === 0 ? 0 : sorted[sorted.length - 1],
+  };
+};
+
+exports.now = function () {
+  return Number(process.hrtime.bigint()) / 1e6;
+};
+
+exports.fetch = function (graphql, queryId, variables) {
+  return new Promise((resolve) => {
+    let result = null;
+    graphql.fetchQuery(
+      queryId,
+      "",
+      variables || "",
+      (payload) => {
+        result = payload;
+      },
+      () => resolve(result)
+    );
+  });
+};
+
+// Scales the payload size by repeating an introspection selection under different aliases.
+exports.buildIntrospectionQuery = function (aliases) {
+  const selections = [];
+
+  for (let i = 0; i < aliases; ++i) {
+    selections.push(`alias${i}: __schema {
+      types {
+        kind
+        name
+        description
+        fields {
+          name
+          description
+          args { name description }
+          type { kind name ofType { kind name } }
+        }
+      }
+    }`);
+  }
+
+  return `query {
+    ${selections.join("\n")}
+  }`;
+};
+
+// Machine-readable output, one JSON object per line.
+exports.report = function (name, fields) {
+  console.log(JSON.stringify({ benchmark: name, ...fields }));
+};
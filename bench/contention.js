@@ -0,0 +1,80 @@
+// Measures subscription delivery under contention: one nodeChange subscription receives the
+// payloads of many concurrent completeTask mutations, so every resolver thread is a producer
+// calling the subscription callback at the same time. Runs once for each producer count. This is the
+// end to end cost, including fetchQuery on the main thread and a thread per deliver, so contention
+// on the MpscRing itself is measured separately by mpsc_ring_benchmark in bench/native.
+const { parseArgs, loadModule, now, fetch, report } = require("./common");
+
+const options = parseArgs({ module: "", producers: "1,2,4,8,16,32", mutations: 20000 });
+const graphql = loadModule(options.module);
+
+const subscriptionQuery = `subscription {
+  nodeChange(id: "ZmFrZVRhc2tJZA==") {
+    id
+  }
+}`;
+const mutationQuery = `mutation {
+  completeTask(input: {id: "ZmFrZVRhc2tJZA==", isComplete: true}) {
+    clientMutationId
+  }
+}`;
+
+async function measure(producers) {
+  graphql.startService({
+    resolverThreads: producers,
+    resolverQueueDepth: options.mutations,
+  });
+
+  let received = 0;
+  let allReceived = null;
+  const delivered = new Promise((resolve) => {
+    allReceived = resolve;
+  });
+  const subscriptionId = graphql.parseQuery(subscriptionQuery);
+
+  graphql.fetchQuery(
+    subscriptionId,
+    "",
+    "",
+    () => {
+      if (++received === options.mutations) {
+        allReceived();
+      }
+    },
+    () => {}
+  );
+
+  const mutationId = graphql.parseQuery(mutationQuery);
+  const mutations = [];
+  const started = now();
+
+  for (let i = 0; i < options.mutations; ++i) {
+    mutations.push(fetch(graphql, mutationId));
+  }
+
+  await Promise.all([...mutations, delivered]);
+
+  const elapsed = now() - started;
+
+  graphql.unsubscribe(subscriptionId);
+  graphql.stopService();
+
+  report("contention", {
+    module: options.module || "default",
+    producers,
+    mutations: options.mutations,
+    elapsedMs: elapsed,
+    payloadsPerSecond: (received * 1000) / elapsed,
+  });
+}
+
+async function main() {
+  for (const producers of String(options.producers).split(",").map(Number)) {
+    await measure(producers);
+  }
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
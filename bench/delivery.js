@@ -0,0 +1,85 @@
+// Measures the latency from issuing a completeTask mutation to each nodeChange subscription
+// receiving its payload in JS, and the latency of the mutation itself. Run it once with the current build, and once with
+// --module=<path to a build of another revision> to compare delivery paths.
+const { parseArgs, loadModule, summarize, now, fetch, report } = require("./common");
+
+const options = parseArgs({ module: "", subscriptions: 100, rounds: 200 });
+const graphql = loadModule(options.module);
+
+const subscriptionQuery = `subscription {
+  nodeChange(id: "ZmFrZVRhc2tJZA==") {
+    id
+  }
+}`;
+const mutationQuery = `mutation {
+  completeTask(input: {id: "ZmFrZVRhc2tJZA==", isComplete: true}) {
+    clientMutationId
+  }
+}`;
+
+async function main() {
+  graphql.startService();
+
+  const latencies = [];
+  const mutationLatencies = [];
+  let roundStart = 0;
+  let pending = 0;
+  let roundDone = null;
+
+  const subscriptionIds = [];
+
+  for (let i = 0; i < options.subscriptions; ++i) {
+    const subscriptionId = graphql.parseQuery(subscriptionQuery);
+
+    subscriptionIds.push(subscriptionId);
+    graphql.fetchQuery(
+      subscriptionId,
+      "",
+      "",
+      () => {
+        latencies.push(now() - roundStart);
+
+        if (--pending === 0) {
+          roundDone();
+        }
+      },
+      () => {}
+    );
+  }
+
+  const mutationId = graphql.parseQuery(mutationQuery);
+  const started = now();
+
+  for (let round = 0; round < options.rounds; ++round) {
+    const delivered = new Promise((resolve) => {
+      roundDone = resolve;
+    });
+
+    pending = options.subscriptions;
+    roundStart = now();
+    const mutated = fetch(graphql, mutationId).then(() => {
+      mutationLatencies.push(now() - roundStart);
+    });
+
+    await Promise.all([mutated, delivered]);
+  }
+
+  const elapsed = now() - started;
+
+  subscriptionIds.forEach((subscriptionId) => graphql.unsubscribe(subscriptionId));
+  graphql.stopService();
+
+  report("delivery", {
+    module: options.module || "default",
+    subscriptions: options.subscriptions,
+    rounds: options.rounds,
+    payloadsPerSecond: (latencies.length * 1000) / elapsed,
+    latencyMs: summarize(latencies),
+    mutationLatencyMs: summarize(mutationLatencies),
+  });
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
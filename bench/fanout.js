@@ -0,0 +1,77 @@
+// Measures completeTask mutation latency with many nodeChange subscriptions open on distinct node
+// ids, of which only one matches the mutation. Each mutation waits for delivery, so the cost of
+// finding the matching subscriptions is part of every sample.
+const { parseArgs, loadModule, summarize, now, report } = require("./common");
+
+const options = parseArgs({ module: "", subscriptions: 10000, rounds: 200 });
+const graphql = loadModule(options.module);
+
+const subscriptionQuery = `subscription ($id: ID!) {
+  nodeChange(id: $id) {
+    id
+  }
+}`;
+const mutationQuery = `mutation {
+  completeTask(input: {id: "ZmFrZVRhc2tJZA==", isComplete: true}) {
+    clientMutationId
+  }
+}`;
+
+function mutate(mutationId) {
+  return new Promise((resolve) => {
+    graphql.fetchQuery(mutationId, "", "", () => {}, () => resolve(), { awaitDelivery: true });
+  });
+}
+
+async function main() {
+  graphql.startService();
+
+  const subscriptionIds = [];
+  let delivered = 0;
+
+  for (let i = 0; i < options.subscriptions; ++i) {
+    // The first subscription is on the task the mutation completes, the rest are on other ids.
+    const id = i === 0 ? "ZmFrZVRhc2tJZA==" : Buffer.from(`node-${i}`).toString("base64");
+    const subscriptionId = graphql.parseQuery(subscriptionQuery);
+
+    subscriptionIds.push(subscriptionId);
+    graphql.fetchQuery(
+      subscriptionId,
+      "",
+      { id },
+      () => {
+        ++delivered;
+      },
+      () => {}
+    );
+  }
+
+  const mutationId = graphql.parseQuery(mutationQuery);
+  const latencies = [];
+
+  // Warm up once, so one-time costs aren't part of the samples.
+  await mutate(mutationId);
+
+  for (let round = 0; round < options.rounds; ++round) {
+    const started = now();
+
+    await mutate(mutationId);
+    latencies.push(now() - started);
+  }
+
+  subscriptionIds.forEach((subscriptionId) => graphql.unsubscribe(subscriptionId));
+  graphql.stopService();
+
+  report("fanout", {
+    module: options.module || "default",
+    subscriptions: options.subscriptions,
+    rounds: options.rounds,
+    delivered,
+    mutationLatencyMs: summarize(latencies),
+  });
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
@@ -0,0 +1,310 @@
+// Open-loop load generator for the native module. It issues a weighted mix of queries, mutations
+// and subscriptions at a fixed rate regardless of how fast they complete, and prints one JSON line
+// per interval and a summary at the end. Latency is measured from when each request was scheduled,
+// so a stalled main thread or a full resolver queue shows up in the percentiles.
+//
+// Build the module for Node with `npm run build:node` and run it with `npm run bench:load`, or run
+// it with Electron acting as Node like the other benchmarks to compare the two runtimes, e.g.:
+//   node bench/load.js --module=build-node/Release/electron-cppgraphql.node --rate=5000
+//   node bench/load.js --module=... --holdSubscriptions=10000 --subscriptions=0
+const crypto = require("crypto");
+const fs = require("fs");
+const { monitorEventLoopDelay } = require("perf_hooks");
+const { parseArgs, loadModule, summarize, now, report } = require("./common");
+
+const options = parseArgs({
+  module: "",
+  // Requests per second, and how many seconds to keep sending them.
+  rate: 1000,
+  duration: 10,
+  // Relative weights of each kind of request in the mix.
+  queries: 80,
+  mutations: 15,
+  subscriptions: 5,
+  // Milliseconds each subscription in the mix stays open before it's unsubscribed.
+  lifetime: 1000,
+  // Subscriptions opened before the run starts and held open until it ends.
+  holdSubscriptions: 0,
+  // Passed to startService, 0 keeps the default.
+  resolverThreads: 0,
+  dispatcherThreads: 0,
+  // Seconds between interval reports.
+  interval: 1,
+});
+const graphql = loadModule(options.module);
+
+const taskId = "ZmFrZVRhc2tJZA==";
+const queryText = `query {
+  appointments { edges { node { id subject when isNow } } }
+  tasks { edges { node { id title isComplete } } }
+  unreadCounts { edges { node { id name unreadCount } } }
+}`;
+const mutationText = `mutation {
+  completeTask(input: {id: "${taskId}", isComplete: true}) {
+    task { id isComplete }
+    clientMutationId
+  }
+}`;
+const subscriptionText = `subscription {
+  nodeChange(id: "${taskId}") {
+    ...on Task { id title isComplete }
+  }
+}`;
+
+const kinds = ["query", "mutation", "subscription"];
+const weights = [options.queries, options.mutations, options.subscriptions];
+const totalWeight = weights.reduce((sum, weight) => sum + weight, 0);
+
+function pickKind() {
+  let remaining = Math.random() * totalWeight;
+
+  for (let i = 0; i < kinds.length; ++i) {
+    remaining -= weights[i];
+
+    if (remaining < 0) {
+      return kinds[i];
+    }
+  }
+
+  return kinds[kinds.length - 1];
+}
+
+// Linux only, null elsewhere.
+function osThreadCount() {
+  try {
+    const match = /^Threads:\s+(\d+)$/m.exec(fs.readFileSync("/proc/self/status", "utf8"));
+
+    return match ? Number(match[1]) : null;
+  } catch {
+    return null;
+  }
+}
+
+// Time a trivial job on the libuv threadpool. If the pool is starved, this grows even though the
+// job itself takes microseconds.
+function probeThreadpool() {
+  const started = now();
+
+  return new Promise((resolve) => {
+    crypto.pbkdf2("probe", "salt", 1, 32, "sha256", () => resolve(now() - started));
+  });
+}
+
+function newStats() {
+  return {
+    latencies: { query: [], mutation: [], subscription: [] },
+    completed: 0,
+    errors: 0,
+    payloads: 0,
+  };
+}
+
+let interval = newStats();
+const overall = newStats();
+let inFlight = 0;
+let openSubscriptions = 0;
+
+function record(kind, scheduled, failed) {
+  const latency = now() - scheduled;
+
+  for (const stats of [interval, overall]) {
+    stats.latencies[kind].push(latency);
+    ++stats.completed;
+
+    if (failed) {
+      ++stats.errors;
+    }
+  }
+}
+
+function countPayload() {
+  ++interval.payloads;
+  ++overall.payloads;
+}
+
+// Queries and mutations are done once complete is called.
+function fetch(kind, queryId, scheduled) {
+  let failed = false;
+
+  ++inFlight;
+  graphql.fetchQuery(
+    queryId,
+    "",
+    "",
+    (payload) => {
+      failed = failed || payload.includes('"errors"');
+    },
+    () => {
+      --inFlight;
+      record(kind, scheduled, failed);
+    }
+  );
+}
+
+// Subscriptions each need their own queryId, so they can be unsubscribed separately. The latency
+// is the time until it's registered, the payloads are counted as they arrive.
+function subscribe(scheduled, lifetime) {
+  const queryId = graphql.parseQuery(subscriptionText);
+
+  ++openSubscriptions;
+  graphql.fetchQuery(queryId, "", "", countPayload, () => {
+    --openSubscriptions;
+    graphql.discardQuery(queryId);
+  });
+
+  if (scheduled !== undefined) {
+    record("subscription", scheduled, false);
+  }
+
+  if (lifetime !== undefined) {
+    setTimeout(() => graphql.unsubscribe(queryId), lifetime);
+  }
+
+  return queryId;
+}
+
+function snapshot(stats, elapsedMs) {
+  const metrics = graphql.getMetrics();
+  const latencyMs = {};
+
+  for (const kind of kinds) {
+    if (stats.latencies[kind].length > 0) {
+      latencyMs[kind] = summarize(stats.latencies[kind]);
+    }
+  }
+
+  return {
+    elapsedMs: Math.round(elapsedMs),
+    throughput: (stats.completed * 1000) / elapsedMs,
+    completed: stats.completed,
+    errors: stats.errors,
+    subscriptionPayloads: stats.payloads,
+    inFlight,
+    openSubscriptions,
+    latencyMs,
+    rssMB: process.memoryUsage().rss / (1024 * 1024),
+    threads: osThreadCount(),
+    executors: metrics.executors,
+  };
+}
+
+async function main() {
+  const serviceOptions = {};
+
+  if (options.resolverThreads > 0) {
+    serviceOptions.resolverThreads = options.resolverThreads;
+  }
+
+  if (options.dispatcherThreads > 0) {
+    serviceOptions.dispatcherThreads = options.dispatcherThreads;
+  }
+
+  graphql.startService(serviceOptions);
+
+  const queryId = graphql.parseQuery(queryText);
+  const mutationId = graphql.parseQuery(mutationText);
+  const held = [];
+
+  for (let i = 0; i < options.holdSubscriptions; ++i) {
+    held.push(subscribe());
+  }
+
+  const eventLoopDelay = monitorEventLoopDelay({ resolution: 10 });
+  const total = Math.round(options.rate * options.duration);
+  const started = now();
+  let intervalStarted = started;
+  let issued = 0;
+
+  eventLoopDelay.enable();
+
+  const reporter = setInterval(async () => {
+    const current = interval;
+    const elapsed = now() - intervalStarted;
+
+    interval = newStats();
+    intervalStarted = now();
+    report("load", {
+      phase: "interval",
+      ...snapshot(current, elapsed),
+      threadpoolProbeMs: await probeThreadpool(),
+      eventLoopDelayMs: {
+        p50: eventLoopDelay.percentile(50) / 1e6,
+        p99: eventLoopDelay.percentile(99) / 1e6,
+        max: eventLoopDelay.max / 1e6,
+      },
+    });
+    eventLoopDelay.reset();
+  }, options.interval * 1000);
+
+  await new Promise((resolve) => {
+    const tick = () => {
+      // Catch up on everything which should have been sent by now, each with the time it was
+      // supposed to go out.
+      const due = Math.min(total, Math.floor(((now() - started) * options.rate) / 1000));
+
+      for (; issued < due; ++issued) {
+        const scheduled = started + (issued * 1000) / options.rate;
+
+        switch (pickKind()) {
+          case "query":
+            fetch("query", queryId, scheduled);
+            break;
+
+          case "mutation":
+            fetch("mutation", mutationId, scheduled);
+            break;
+
+          case "subscription":
+            subscribe(scheduled, options.lifetime);
+            break;
+        }
+      }
+
+      if (issued < total) {
+        setTimeout(tick, 1);
+      } else {
+        resolve();
+      }
+    };
+
+    tick();
+  });
+
+  // Let the requests which are still running finish, and the last subscriptions expire.
+  const drainStarted = now();
+
+  while ((inFlight > 0 || openSubscriptions > held.length) && now() - drainStarted < 30000) {
+    await new Promise((resolve) => setTimeout(resolve, 10));
+  }
+
+  clearInterval(reporter);
+  eventLoopDelay.disable();
+
+  const summary = snapshot(overall, now() - started);
+
+  held.forEach((subscriptionId) => graphql.unsubscribe(subscriptionId));
+  graphql.discardQuery(queryId);
+  graphql.discardQuery(mutationId);
+  graphql.stopService();
+
+  report("load", {
+    phase: "summary",
+    module: options.module || "default",
+    runtime: process.versions.electron ? `electron ${process.versions.electron}` : "node",
+    node: process.versions.node,
+    rate: options.rate,
+    duration: options.duration,
+    mix: {
+      queries: options.queries,
+      mutations: options.mutations,
+      subscriptions: options.subscriptions,
+    },
+    holdSubscriptions: options.holdSubscriptions,
+    ...summary,
+  });
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
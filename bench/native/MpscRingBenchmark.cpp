@@ -0,0 +1,166 @@
+#include "MpscRing.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Payloads each producer queues per iteration, split evenly across the producers.
+constexpr std::int64_t ItemsPerIteration = 1 << 16;
+
+// What SubscriptionPayloadQueue::Deliver does when the ring is full: take the lock and queue the
+// payload behind it instead of waiting for the consumer.
+class LockedQueue
+{
+public:
+	void Push(std::uint64_t value)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_values.push_back(value);
+	}
+
+	size_t Drain()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		const auto count = _values.size();
+
+		_values.clear();
+
+		return count;
+	}
+
+private:
+	std::mutex _mutex;
+	std::deque<std::uint64_t> _values;
+};
+
+// The producers push to the ring directly and fall back to the LockedQueue when it's full, while
+// the benchmark thread drains both as the consumer, like the SubscriptionDispatcher. Reports the
+// fraction of pushes which had to take the lock.
+void benchmarkRing(benchmark::State& state)
+{
+	const auto producers = static_cast<size_t>(state.range(0));
+	const auto capacity = static_cast<size_t>(state.range(1));
+	const auto perProducer = ItemsPerIteration / static_cast<std::int64_t>(producers);
+	std::int64_t fallbacks = 0;
+
+	for (auto _ : state)
+	{
+		MpscRing<std::uint64_t> ring { capacity };
+		LockedQueue overflow;
+		std::atomic<std::int64_t> overflowed { 0 };
+		std::vector<std::thread> threads;
+		std::int64_t received = 0;
+
+		threads.reserve(producers);
+
+		for (size_t i = 0; i < producers; ++i)
+		{
+			threads.emplace_back([&ring, &overflow, &overflowed, perProducer]() {
+				for (std::int64_t value = 0; value < perProducer; ++value)
+				{
+					auto item = static_cast<std::uint64_t>(value);
+
+					if (!ring.TryPush(std::move(item)))
+					{
+						overflow.Push(item);
+						overflowed.fetch_add(1, std::memory_order_relaxed);
+					}
+				}
+			});
+		}
+
+		const auto expected = perProducer * static_cast<std::int64_t>(producers);
+
+		while (received < expected)
+		{
+			while (auto value = ring.TryPop())
+			{
+				benchmark::DoNotOptimize(*value);
+				++received;
+			}
+
+			received += static_cast<std::int64_t>(overflow.Drain());
+			std::this_thread::yield();
+		}
+
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+
+		fallbacks += overflowed.load();
+	}
+
+	const auto items = state.iterations() * perProducer * static_cast<std::int64_t>(producers);
+
+	state.SetItemsProcessed(items);
+	state.counters["fallbackRate"] =
+		items > 0 ? static_cast<double>(fallbacks) / static_cast<double>(items) : 0.0;
+}
+
+// The same producers and consumer with every push going through the LockedQueue, which is what
+// the bounded subscriptions and the ring's fallback both pay for.
+void benchmarkLocked(benchmark::State& state)
+{
+	const auto producers = static_cast<size_t>(state.range(0));
+	const auto perProducer = ItemsPerIteration / static_cast<std::int64_t>(producers);
+
+	for (auto _ : state)
+	{
+		LockedQueue queue;
+		std::vector<std::thread> threads;
+		std::int64_t received = 0;
+
+		threads.reserve(producers);
+
+		for (size_t i = 0; i < producers; ++i)
+		{
+			threads.emplace_back([&queue, perProducer]() {
+				for (std::int64_t value = 0; value < perProducer; ++value)
+				{
+					queue.Push(static_cast<std::uint64_t>(value));
+				}
+			});
+		}
+
+		const auto expected = perProducer * static_cast<std::int64_t>(producers);
+
+		while (received < expected)
+		{
+			received += static_cast<std::int64_t>(queue.Drain());
+			std::this_thread::yield();
+		}
+
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+	}
+
+	state.SetItemsProcessed(
+		state.iterations() * perProducer * static_cast<std::int64_t>(producers));
+}
+
+// 16 is SubscriptionPayloadQueue::RingCapacity, the larger ring shows what the fallback costs.
+BENCHMARK(benchmarkRing)
+	->ArgsProduct({ { 1, 2, 4, 8, 16, 32 }, { 16, 1024 } })
+	->ArgNames({ "producers", "capacity" })
+	->UseRealTime()
+	->Unit(benchmark::kMicrosecond);
+BENCHMARK(benchmarkLocked)
+	->ArgsProduct({ { 1, 2, 4, 8, 16, 32 } })
+	->ArgNames({ "producers" })
+	->UseRealTime()
+	->Unit(benchmark::kMicrosecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
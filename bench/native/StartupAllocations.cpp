@@ -0,0 +1,153 @@
+#include "SchemaLoader.h"
+#include "TodayMock.h"
+
+#include "graphqlservice/JSONResponse.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string_view>
+#include <vector>
+
+using namespace graphql;
+
+namespace {
+
+// Every call to the replaceable global operator new in this process, which is what the schema and
+// the introspection objects allocate with.
+std::atomic<std::uint64_t> s_allocations { 0 };
+
+void* countedAllocate(std::size_t size)
+{
+	s_allocations.fetch_add(1, std::memory_order_relaxed);
+
+	if (void* memory = std::malloc(size == 0 ? 1 : size))
+	{
+		return memory;
+	}
+
+	throw std::bad_alloc {};
+}
+
+constexpr std::string_view introspectionQuery = R"gql(query {
+	__schema {
+		queryType { name }
+		types { name kind fields(includeDeprecated: true) { name args { name } } }
+	}
+})gql";
+
+struct Step
+{
+	std::uint64_t allocations;
+	double milliseconds;
+};
+
+template <class Function>
+Step measure(Function&& function)
+{
+	const auto allocations = s_allocations.load();
+	const auto start = std::chrono::steady_clock::now();
+
+	function();
+
+	return { s_allocations.load() - allocations,
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+			.count() };
+}
+
+void print(std::string_view name, const Step& step, bool last = false)
+{
+	std::cout << "\"" << name << "\":{\"allocations\":" << step.allocations
+			  << ",\"ms\":" << step.milliseconds << "}" << (last ? "" : ",");
+}
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+	return countedAllocate(size);
+}
+
+void* operator new[](std::size_t size)
+{
+	return countedAllocate(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+// Counts the allocations and time for each step the addon takes from loading to the first
+// introspection query, in a fresh process so nothing is cached yet, and prints them as one JSON
+// object for bench/startup.js. The schema and the service are what startService pays for, the
+// introspection objects are only built for the first query which selects __schema or __type.
+int main()
+{
+	std::shared_ptr<schema::Schema> schema;
+	std::shared_ptr<service::Request> service;
+	response::Value result;
+
+	const auto schemaStep = measure([&schema]() {
+		schema = getSchema();
+	});
+	const auto serviceStep = measure([&service]() {
+		auto query = std::make_shared<today::Query>(
+			[]() -> std::vector<std::shared_ptr<today::Appointment>> {
+				return {};
+			},
+			[]() -> std::vector<std::shared_ptr<today::Task>> {
+				return {};
+			},
+			[]() -> std::vector<std::shared_ptr<today::Folder>> {
+				return {};
+			});
+		auto mutation = std::make_shared<today::Mutation>(
+			[](const std::shared_ptr<service::RequestState>&,
+				today::CompleteTaskInput&&) -> std::shared_ptr<today::CompleteTaskPayload> {
+				return nullptr;
+			});
+
+		service = std::make_shared<today::Operations>(std::move(query),
+			std::move(mutation),
+			std::shared_ptr<today::Subscription> {});
+	});
+	const auto firstQueryStep = measure([&service, &result]() {
+		auto ast = peg::parseString(introspectionQuery);
+		response::Value variables(response::Type::Map);
+
+		result = service->resolve({ ast, {}, std::move(variables) }).get();
+	});
+
+	if (result.type() != response::Type::Map || result.find("errors") != result.end())
+	{
+		std::cerr << "Introspection failed: " << response::toJSON(std::move(result)) << std::endl;
+		return 1;
+	}
+
+	std::cout << "{";
+	print("schema", schemaStep);
+	print("service", serviceStep);
+	print("firstIntrospection", firstQueryStep, true);
+	std::cout << "}" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,494 @@
+#include "TodayMock.h"
+
+#include "graphqlservice/JSONResponse.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace graphql;
+
+namespace {
+
+// Enough tasks that a lookup which scans them instead of using the EntityStore stands out. The
+// connections are pages of the same tasks.
+constexpr int TaskCount = 1'000'000;
+constexpr int LargestPage = 100'000;
+constexpr int AppointmentCount = 1'000;
+constexpr int NestedDepth = 32;
+
+constexpr std::string_view introspectionQuery = R"gql(query IntrospectionQuery {
+	__schema {
+		queryType { name }
+		mutationType { name }
+		subscriptionType { name }
+		types { ...FullType }
+		directives {
+			name
+			description
+			locations
+			args { ...InputValue }
+		}
+	}
+}
+
+fragment FullType on __Type {
+	kind
+	name
+	description
+	fields(includeDeprecated: true) {
+		name
+		description
+		args { ...InputValue }
+		type { ...TypeRef }
+		isDeprecated
+		deprecationReason
+	}
+	inputFields { ...InputValue }
+	interfaces { ...TypeRef }
+	enumValues(includeDeprecated: true) {
+		name
+		description
+		isDeprecated
+		deprecationReason
+	}
+	possibleTypes { ...TypeRef }
+}
+
+fragment InputValue on __InputValue {
+	name
+	description
+	type { ...TypeRef }
+	defaultValue
+}
+
+fragment TypeRef on __Type {
+	kind
+	name
+	ofType {
+		kind
+		name
+		ofType {
+			kind
+			name
+			ofType {
+				kind
+				name
+				ofType {
+					kind
+					name
+					ofType {
+						kind
+						name
+						ofType {
+							kind
+							name
+							ofType {
+								kind
+								name
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+})gql";
+
+constexpr std::string_view tasksQuery = R"gql(query Tasks($first: Int) {
+	tasks(first: $first) {
+		pageInfo { hasNextPage hasPreviousPage }
+		edges {
+			cursor
+			node { id title isComplete }
+		}
+	}
+})gql";
+
+constexpr std::string_view tasksAfterQuery = R"gql(query TasksAfter($after: ItemCursor) {
+	tasks(first: 10, after: $after) {
+		pageInfo { hasNextPage hasPreviousPage }
+		edges {
+			cursor
+			node { id title isComplete }
+		}
+	}
+})gql";
+
+constexpr std::string_view tasksByIdQuery = R"gql(query TasksById($ids: [ID!]!) {
+	tasksById(ids: $ids) { id title isComplete }
+})gql";
+
+constexpr std::string_view anyTypeQuery = R"gql(query AnyType($ids: [ID!]!) {
+	anyType(ids: $ids) {
+		__typename
+		...on Node { id }
+		...on Appointment { when subject isNow }
+		...on Task { title isComplete }
+		...on Folder { name unreadCount }
+	}
+})gql";
+
+// One document and the variables for each size it's resolved at. Parse and Validate only depend
+// on the text, so they're measured once per document.
+struct Document
+{
+	std::string name;
+	std::string text;
+	std::vector<std::pair<std::string, response::Value>> cases;
+};
+
+response::IdType makeId(std::string_view prefix, int index)
+{
+	const auto text = std::string { prefix } + std::to_string(index);
+	response::IdType id(text.size());
+
+	std::copy(text.cbegin(), text.cend(), id.begin());
+
+	return id;
+}
+
+std::shared_ptr<today::Operations> buildService()
+{
+	std::vector<std::shared_ptr<today::Appointment>> appointments;
+	std::vector<std::shared_ptr<today::Task>> tasks;
+
+	appointments.reserve(AppointmentCount);
+
+	for (int i = 0; i < AppointmentCount; ++i)
+	{
+		appointments.push_back(std::make_shared<today::Appointment>(makeId("appointment", i),
+			"tomorrow",
+			"Appointment " + std::to_string(i),
+			i == 0));
+	}
+
+	tasks.reserve(TaskCount);
+
+	for (int i = 0; i < TaskCount; ++i)
+	{
+		tasks.push_back(std::make_shared<today::Task>(makeId("task", i),
+			"Task " + std::to_string(i),
+			i % 2 == 0));
+	}
+
+	auto query = std::make_shared<today::Query>(
+		[appointments = std::move(appointments)]() {
+			return appointments;
+		},
+		[tasks = std::move(tasks)]() {
+			return tasks;
+		},
+		[]() -> std::vector<std::shared_ptr<today::Folder>> {
+			return { std::make_shared<today::Folder>(makeId("folder", 0), "Inbox", 3) };
+		});
+	auto mutation = std::make_shared<today::Mutation>(
+		[](const std::shared_ptr<service::RequestState>&,
+			today::CompleteTaskInput&&) -> std::shared_ptr<today::CompleteTaskPayload> {
+			return nullptr;
+		});
+
+	return std::make_shared<today::Operations>(std::move(query),
+		std::move(mutation),
+		std::shared_ptr<today::Subscription> {});
+}
+
+// A chain of fragment spreads, each of which selects the next level of NestedType.
+std::string buildNestedQuery(int depth)
+{
+	std::ostringstream oss;
+
+	oss << "query Nested { nested { ...Nested1 } }\n";
+
+	for (int i = 1; i < depth; ++i)
+	{
+		oss << "fragment Nested" << i << " on NestedType { depth nested { ...Nested" << (i + 1)
+			<< " } }\n";
+	}
+
+	oss << "fragment Nested" << depth << " on NestedType { depth }\n";
+
+	return oss.str();
+}
+
+// The cursor of the last edge in the largest page of tasks, as the service returned it.
+response::Value lastCursorOfLargestPage(today::Operations& service)
+{
+	auto ast = peg::parseString(tasksQuery);
+	response::Value variables(response::Type::Map);
+
+	variables.emplace_back("first", response::Value(LargestPage));
+
+	auto result = service.resolve({ ast, {}, std::move(variables) }).get();
+	const auto& edges = result["data"]["tasks"]["edges"].get<response::ListType>();
+
+	return response::Value { edges.back()["cursor"] };
+}
+
+std::vector<Document> buildDocuments(today::Operations& service)
+{
+	std::vector<Document> documents;
+	Document introspection { "introspection", std::string { introspectionQuery } };
+	Document connection { "tasks", std::string { tasksQuery } };
+	Document nested { "nested", buildNestedQuery(NestedDepth) };
+	Document tasksAfter { "tasksAfter", std::string { tasksAfterQuery } };
+	Document tasksById { "tasksById", std::string { tasksByIdQuery } };
+	Document anyType { "anyType", std::string { anyTypeQuery } };
+
+	introspection.cases.emplace_back(std::string {}, response::Value(response::Type::Map));
+
+	for (const int first : { 10, 1'000, LargestPage })
+	{
+		response::Value variables(response::Type::Map);
+
+		variables.emplace_back("first", response::Value(first));
+		connection.cases.emplace_back(std::to_string(first), std::move(variables));
+	}
+
+	nested.cases.emplace_back(std::string {}, response::Value(response::Type::Map));
+
+	// A 10 edge page deep into the tasks, once with a cursor the service returned, which already
+	// knows its position, and once with just the id of the task near the end of the list, which
+	// has to be looked up.
+	response::Value cursorVariables(response::Type::Map);
+	response::Value idVariables(response::Type::Map);
+
+	cursorVariables.emplace_back("after", lastCursorOfLargestPage(service));
+	tasksAfter.cases.emplace_back("cursor", std::move(cursorVariables));
+	idVariables.emplace_back("after", response::Value(makeId("task", TaskCount - 10)));
+	tasksAfter.cases.emplace_back("id", std::move(idVariables));
+
+	// Spread the ids across the whole list, with the last task included, so they can't all be
+	// found near the front.
+	for (const int count : { 1, 1'000 })
+	{
+		response::Value taskIds(response::Type::List);
+		response::Value variables(response::Type::Map);
+
+		for (int i = 0; i < count; ++i)
+		{
+			const auto index = TaskCount - 1 - static_cast<int>(static_cast<std::int64_t>(i)
+					* TaskCount / count);
+
+			taskIds.emplace_back(response::Value(makeId("task", index)));
+		}
+
+		variables.emplace_back("ids", std::move(taskIds));
+		tasksById.cases.emplace_back(std::to_string(count), std::move(variables));
+	}
+
+	// getAnyType returns every appointment regardless of the ids.
+	response::Value ids(response::Type::List);
+	response::Value anyTypeVariables(response::Type::Map);
+
+	ids.emplace_back(response::Value(makeId("appointment", 0)));
+	anyTypeVariables.emplace_back("ids", std::move(ids));
+	anyType.cases.emplace_back(std::string {}, std::move(anyTypeVariables));
+
+	documents.push_back(std::move(introspection));
+	documents.push_back(std::move(connection));
+	documents.push_back(std::move(nested));
+	documents.push_back(std::move(tasksAfter));
+	documents.push_back(std::move(tasksById));
+	documents.push_back(std::move(anyType));
+
+	return documents;
+}
+
+peg::ast parseAndValidate(const today::Operations& service, const Document& document)
+{
+	auto ast = peg::parseString(document.text);
+	auto errors = service.validate(ast);
+
+	if (!errors.empty())
+	{
+		throw service::schema_exception { std::move(errors) };
+	}
+
+	return ast;
+}
+
+response::Value resolve(
+	today::Operations& service, const peg::ast& ast, const response::Value& variables)
+{
+	auto result = service.resolve({ ast, {}, response::Value { variables } }).get();
+
+	// NestedType records the params of every instance in a static stack for the unit tests, so
+	// drain it before it grows without bound.
+	today::NestedType::getCapturedParams();
+
+	return result;
+}
+
+// Every id in tasksById refers to a task, so a null in the result means a lookup in the EntityStore
+// missed. Checked once at full scale before anything is timed.
+bool verifyTasksById(today::Operations& service, const Document& document)
+{
+	const auto ast = parseAndValidate(service, document);
+
+	for (const auto& [size, variables] : document.cases)
+	{
+		const auto result = resolve(service, ast, variables);
+		const auto& tasks = result["data"]["tasksById"].get<response::ListType>();
+
+		if (tasks.size() != variables["ids"].size()
+			|| std::any_of(tasks.cbegin(), tasks.cend(), [](const response::Value& task) {
+				   return task.type() != response::Type::Map;
+			   }))
+		{
+			std::cerr << "tasksById/" << size << " didn't find every task" << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void benchmarkParse(benchmark::State& state, const Document& document)
+{
+	for (auto _ : state)
+	{
+		auto ast = peg::parseString(document.text);
+
+		benchmark::DoNotOptimize(ast.root);
+	}
+
+	state.SetBytesProcessed(
+		static_cast<std::int64_t>(state.iterations() * document.text.size()));
+}
+
+void benchmarkValidate(
+	benchmark::State& state, const today::Operations& service, const Document& document)
+{
+	const auto parsed = peg::parseString(document.text);
+
+	for (auto _ : state)
+	{
+		// The copy shares the parsed tree, clearing the flag makes validate visit it again.
+		auto ast = parsed;
+
+		ast.validated = false;
+
+		auto errors = service.validate(ast);
+
+		if (!errors.empty())
+		{
+			state.SkipWithError("Validation failed");
+			break;
+		}
+	}
+}
+
+void benchmarkResolve(benchmark::State& state, today::Operations& service,
+	const Document& document, const response::Value& variables)
+{
+	const auto ast = parseAndValidate(service, document);
+
+	for (auto _ : state)
+	{
+		auto result = resolve(service, ast, variables);
+
+		benchmark::DoNotOptimize(result);
+	}
+}
+
+void benchmarkToJSON(benchmark::State& state, today::Operations& service,
+	const Document& document, const response::Value& variables)
+{
+	const auto resolved = resolve(service, parseAndValidate(service, document), variables);
+	std::int64_t bytes = 0;
+
+	for (auto _ : state)
+	{
+		// toJSON consumes the document, leave the copy out of the measurement.
+		state.PauseTiming();
+
+		response::Value copy { resolved };
+
+		state.ResumeTiming();
+
+		const auto json = response::toJSON(std::move(copy));
+
+		bytes += static_cast<std::int64_t>(json.size());
+	}
+
+	state.SetBytesProcessed(bytes);
+}
+
+} // namespace
+
+// Pass --benchmark_format=json, or --benchmark_out=<file> --benchmark_out_format=json, for output
+// which can be compared across revisions, e.g. with compare.py from Google Benchmark.
+int main(int argc, char** argv)
+{
+	benchmark::Initialize(&argc, argv);
+
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+	{
+		return 1;
+	}
+
+	const auto service = buildService();
+	std::vector<Document> documents;
+
+	try
+	{
+		documents = buildDocuments(*service);
+
+		for (const auto& document : documents)
+		{
+			parseAndValidate(*service, document);
+
+			if (document.name == "tasksById" && !verifyTasksById(*service, document))
+			{
+				return 1;
+			}
+		}
+	}
+	catch (const std::exception& ex)
+	{
+		std::cerr << "Invalid benchmark document: " << ex.what() << std::endl;
+		return 1;
+	}
+
+	for (const auto& document : documents)
+	{
+		benchmark::RegisterBenchmark(("Parse/" + document.name).c_str(),
+			[&document](benchmark::State& state) {
+				benchmarkParse(state, document);
+			})
+			->Unit(benchmark::kMicrosecond);
+		benchmark::RegisterBenchmark(("Validate/" + document.name).c_str(),
+			[&service, &document](benchmark::State& state) {
+				benchmarkValidate(state, *service, document);
+			})
+			->Unit(benchmark::kMicrosecond);
+
+		for (const auto& [size, variables] : document.cases)
+		{
+			const auto suffix = size.empty() ? document.name : document.name + '/' + size;
+
+			benchmark::RegisterBenchmark(("Resolve/" + suffix).c_str(),
+				[&service, &document, &variables = variables](benchmark::State& state) {
+					benchmarkResolve(state, *service, document, variables);
+				})
+				->Unit(benchmark::kMicrosecond);
+			benchmark::RegisterBenchmark(("ToJSON/" + suffix).c_str(),
+				[&service, &document, &variables = variables](benchmark::State& state) {
+					benchmarkToJSON(state, *service, document, variables);
+				})
+				->Unit(benchmark::kMicrosecond);
+		}
+	}
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+
+	return 0;
+}
@@ -0,0 +1,77 @@
+// Compares the time until a payload is usable as a JS object: string output followed by JSON.parse,
+// against object output which builds the objects natively. Reports each payload size and the first
+// size at which object output wins.
+const {
+  parseArgs,
+  loadModule,
+  summarize,
+  now,
+  report,
+  buildIntrospectionQuery,
+} = require("./common");
+
+const options = parseArgs({ module: "", aliases: "1,2,5,10,25,50,100", iterations: 30 });
+const graphql = loadModule(options.module);
+
+function fetchObject(queryId, output) {
+  return new Promise((resolve) => {
+    const started = now();
+    let elapsed = 0;
+
+    graphql.fetchQuery(
+      queryId,
+      "",
+      "",
+      (payload) => {
+        const result = output === "object" ? payload : JSON.parse(payload);
+
+        elapsed = now() - started;
+        return result;
+      },
+      () => resolve(elapsed),
+      { output }
+    );
+  });
+}
+
+async function main() {
+  graphql.startService();
+
+  let crossover = null;
+
+  for (const aliases of options.aliases.split(",").map(Number)) {
+    const queryId = graphql.parseQuery(buildIntrospectionQuery(aliases));
+    const results = {};
+
+    for (const output of ["string", "object"]) {
+      const samples = [];
+
+      for (let i = 0; i < options.iterations; ++i) {
+        samples.push(await fetchObject(queryId, output));
+      }
+
+      results[output] = summarize(samples);
+    }
+
+    if (crossover === null && results.object.p50 < results.string.p50) {
+      crossover = aliases;
+    }
+
+    report("output", {
+      module: options.module || "default",
+      aliases,
+      jsonParseMs: results.string,
+      objectMs: results.object,
+    });
+
+    graphql.discardQuery(queryId);
+  }
+
+  report("output-crossover", { aliases: crossover });
+  graphql.stopService();
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
@@ -0,0 +1,86 @@
+// Compares the default string output against external output for a range of payload sizes. The
+// payload size is scaled by repeating an introspection selection under different aliases. Run with
+// --expose-gc (e.g. electron --js-flags=--expose-gc) for more stable memory numbers.
+const {
+  parseArgs,
+  loadModule,
+  summarize,
+  now,
+  report,
+  buildIntrospectionQuery,
+} = require("./common");
+
+const options = parseArgs({ module: "", aliases: "1,10,100,400", iterations: 20 });
+const graphql = loadModule(options.module);
+
+function collect() {
+  if (global.gc) {
+    global.gc();
+  }
+}
+
+function fetchPayload(queryId, output) {
+  return new Promise((resolve) => {
+    const started = now();
+    let received = null;
+    let latency = 0;
+
+    graphql.fetchQuery(
+      queryId,
+      "",
+      "",
+      (payload) => {
+        latency = now() - started;
+        received = payload;
+      },
+      () => resolve({ payload: received, latency }),
+      { output }
+    );
+  });
+}
+
+async function main() {
+  graphql.startService();
+
+  for (const aliases of options.aliases.split(",").map(Number)) {
+    const queryId = graphql.parseQuery(buildIntrospectionQuery(aliases));
+
+    for (const output of ["string", "external"]) {
+      const latencies = [];
+      const heapDeltas = [];
+      const rssDeltas = [];
+      let bytes = 0;
+
+      for (let i = 0; i < options.iterations; ++i) {
+        collect();
+
+        const before = process.memoryUsage();
+        const { payload, latency } = await fetchPayload(queryId, output);
+        const after = process.memoryUsage();
+
+        bytes = payload.length;
+        latencies.push(latency);
+        heapDeltas.push((after.heapUsed + after.external - before.heapUsed - before.external) / 1024);
+        rssDeltas.push((after.rss - before.rss) / 1024);
+      }
+
+      report("payload", {
+        module: options.module || "default",
+        output,
+        bytes,
+        latencyMs: summarize(latencies),
+        heapAndExternalKb: summarize(heapDeltas),
+        rssKb: summarize(rssDeltas),
+      });
+    }
+
+    graphql.discardQuery(queryId);
+  }
+
+  graphql.stopService();
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
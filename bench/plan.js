@@ -0,0 +1,78 @@
+// Measures fetchQuery round trips for fragment-heavy documents: a chain of nested fragments on
+// NestedType, in a document which also carries other operations so each fetch has to pick the
+// right one by operationName. Compare against another revision with --module=<path>.
+const { parseArgs, loadModule, summarize, now, fetch, report } = require("./common");
+
+const options = parseArgs({ module: "", depth: 10, operations: 20, iterations: 500 });
+const graphql = loadModule(options.module);
+
+function buildDocument(depth, operations) {
+  const parts = [
+    `query NestedFragments {
+      nested { ...Depth1 }
+    }`,
+  ];
+
+  for (let i = 1; i < depth; ++i) {
+    parts.push(`fragment Depth${i} on NestedType {
+      depth
+      nested { ...Depth${i + 1} }
+    }`);
+  }
+
+  parts.push(`fragment Depth${depth} on NestedType {
+    depth
+  }`);
+
+  for (let i = 0; i < operations; ++i) {
+    parts.push(`query Other${i} {
+      testTaskState
+    }`);
+  }
+
+  return parts.join("\n");
+}
+
+function fetchOperation(queryId, operationName) {
+  return new Promise((resolve) => {
+    graphql.fetchQuery(
+      queryId,
+      operationName,
+      "",
+      () => {},
+      () => resolve()
+    );
+  });
+}
+
+async function main() {
+  graphql.startService();
+
+  const queryId = graphql.parseQuery(buildDocument(options.depth, options.operations));
+  const latencies = [];
+
+  // Warm up once, so one-time costs aren't part of the samples.
+  await fetch(graphql, graphql.parseQuery("{ testTaskState }"));
+
+  for (let i = 0; i < options.iterations; ++i) {
+    const started = now();
+
+    await fetchOperation(queryId, "NestedFragments");
+    latencies.push(now() - started);
+  }
+
+  graphql.discardQuery(queryId);
+  graphql.stopService();
+
+  report("plan", {
+    module: options.module || "default",
+    depth: options.depth,
+    operations: options.operations,
+    latencyMs: summarize(latencies),
+  });
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
@@ -0,0 +1,120 @@
+// Measures cold start: loading the module and the first startService in a fresh process, with and
+// without some idle time in between (like an app which creates its windows first), plus a
+// stopService/startService cycle. Allocations are counted by startup_allocations from bench/native,
+// which replaces the global operator new, since RSS doesn't move for most small allocations. Pass
+// --allocations=<path> if it isn't in the default build directory, and compare against another
+// revision with --module=<path>.
+const fs = require("fs");
+const path = require("path");
+const { spawnSync } = require("child_process");
+const { parseArgs, loadModule, summarize, now, report } = require("./common");
+
+const options = parseArgs({
+  module: "",
+  processes: 20,
+  idleMs: 100,
+  child: "",
+  allocations: path.join(__dirname, "..", "build", "bench", "native", "startup_allocations"),
+});
+
+function sleep(ms) {
+  const shared = new Int32Array(new SharedArrayBuffer(4));
+  Atomics.wait(shared, 0, 0, ms);
+}
+
+function runChild() {
+  const loadStarted = now();
+  const graphql = loadModule(options.module);
+  const loadMs = now() - loadStarted;
+
+  sleep(options.idleMs);
+
+  const startStarted = now();
+  graphql.startService();
+  const startMs = now() - startStarted;
+
+  graphql.stopService();
+
+  const restartStarted = now();
+  graphql.startService();
+  const restartMs = now() - restartStarted;
+
+  graphql.stopService();
+
+  console.log(JSON.stringify({ loadMs, startMs, restartMs }));
+}
+
+function runProcesses(idleMs) {
+  const samples = { loadMs: [], startMs: [], restartMs: [] };
+
+  for (let i = 0; i < options.processes; ++i) {
+    const child = spawnSync(
+      process.execPath,
+      [
+        __filename,
+        "--child=1",
+        `--idleMs=${idleMs}`,
+        ...(options.module ? [`--module=${options.module}`] : []),
+      ],
+      { env: process.env, encoding: "utf8" }
+    );
+
+    if (child.status !== 0) {
+      throw new Error(child.stderr);
+    }
+
+    const result = JSON.parse(child.stdout.trim().split("\n").pop());
+
+    for (const name of Object.keys(samples)) {
+      samples[name].push(result[name]);
+    }
+  }
+
+  report("startup", {
+    idleMs,
+    load: summarize(samples.loadMs),
+    startService: summarize(samples.startMs),
+    restart: summarize(samples.restartMs),
+  });
+}
+
+// The allocation counts are deterministic, so one process is enough, but the times are sampled.
+function runAllocations() {
+  if (!fs.existsSync(options.allocations)) {
+    console.error(
+      `Skipping allocations, build ${options.allocations} with the BUILD_NATIVE_BENCHMARKS option`
+    );
+    return;
+  }
+
+  const steps = {};
+
+  for (let i = 0; i < options.processes; ++i) {
+    const child = spawnSync(options.allocations, [], { encoding: "utf8" });
+
+    if (child.status !== 0) {
+      throw new Error(child.stderr);
+    }
+
+    for (const [name, step] of Object.entries(JSON.parse(child.stdout.trim()))) {
+      steps[name] = steps[name] || { allocations: step.allocations, ms: [] };
+      steps[name].ms.push(step.ms);
+    }
+  }
+
+  for (const [name, step] of Object.entries(steps)) {
+    report("startupAllocations", {
+      step: name,
+      allocations: step.allocations,
+      ms: summarize(step.ms),
+    });
+  }
+}
+
+if (options.child) {
+  runChild();
+} else {
+  runProcesses(0);
+  runProcesses(options.idleMs);
+  runAllocations();
+}
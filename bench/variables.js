@@ -0,0 +1,57 @@
+// Measures fetchQuery round trips for tasksById with a large list of IDs, passing the variables as
+// a JSON string, as a plain object, and as an object with binary (Buffer) IDs.
+const { parseArgs, loadModule, summarize, now, report } = require("./common");
+
+const options = parseArgs({ module: "", ids: 5000, iterations: 100 });
+const graphql = loadModule(options.module);
+
+function fetchVariables(queryId, makeVariables) {
+  return new Promise((resolve) => {
+    // Include building the variables, since JSON.stringify is part of the cost of the string form.
+    graphql.fetchQuery(queryId, "", makeVariables(), () => {}, () => resolve());
+  });
+}
+
+async function main() {
+  graphql.startService();
+
+  const queryId = graphql.parseQuery(`query ($ids: [ID!]!) {
+    tasksById(ids: $ids) { id }
+  }`);
+  const ids = new Array(options.ids).fill("ZmFrZVRhc2tJZA==");
+  const binaryIds = new Array(options.ids).fill(Buffer.from("fakeTaskId"));
+  const modes = {
+    string: () => JSON.stringify({ ids }),
+    object: () => ({ ids }),
+    binary: () => ({ ids: binaryIds }),
+  };
+
+  for (const [mode, makeVariables] of Object.entries(modes)) {
+    const latencies = [];
+
+    // Warm up once, so one-time costs aren't part of the samples.
+    await fetchVariables(queryId, makeVariables);
+
+    for (let i = 0; i < options.iterations; ++i) {
+      const started = now();
+
+      await fetchVariables(queryId, makeVariables);
+      latencies.push(now() - started);
+    }
+
+    report("variables", {
+      module: options.module || "default",
+      mode,
+      ids: options.ids,
+      latencyMs: summarize(latencies),
+    });
+  }
+
+  graphql.discardQuery(queryId);
+  graphql.stopService();
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
@@ -3,9 +3,10 @@ const { app, ipcMain } = require("electron");
 
 const graphql = require("bindings")("electron-cppgraphql.node");
 let serviceStarted = false;
+let serviceOptions = undefined;
 
 function startService() {
-  graphql.startService();
+  graphql.startService(serviceOptions);
   serviceStarted = true;
 }
 
@@ -14,15 +15,22 @@ function stopService() {
   graphql.stopService();
 }
 
-exports.startGraphQL = function() {
+exports.startGraphQL = function(options) {
+  serviceOptions = options;
+
   // Register the IPC callbacks
   ipcMain.handle("startService", startService);
   ipcMain.handle("stopService", stopService);
-  ipcMain.handle("parseQuery", (_event, query) => graphql.parseQuery(query));
+  ipcMain.handle("parseQuery", (_event, query) =>
+    graphql.parseQueryAsync(query)
+  );
+  ipcMain.handle("parsePersistedQuery", (_event, hash) =>
+    graphql.parsePersistedQuery(hash)
+  );
   ipcMain.handle("discardQuery", (_event, queryId) =>
     graphql.discardQuery(queryId)
   );
-  ipcMain.on("fetchQuery", (event, queryId, operationName, variables) =>
+  ipcMain.on("fetchQuery", (event, queryId, operationName, variables, options) =>
     graphql.fetchQuery(
       queryId,
       operationName,
@@ -36,7 +44,8 @@ exports.startGraphQL = function() {
         if (serviceStarted) {
           event.reply("completed", queryId);
         }
-      }
+      },
+      options
     )
   );
   ipcMain.handle("unsubscribe", (_event, queryId) =>
@@ -2,8 +2,121 @@ const { ipcRenderer, contextBridge } = require("electron");
 
 let _callbacks = [];
 
+// Must match QueryRegistry::Normalize in the native module: drop the ignored tokens (whitespace,
+// line terminators, commas and comments) and separate the remaining tokens with a single space.
+function normalizeQuery(query) {
+  let result = "";
+  let separate = false;
+  let i = 0;
+
+  while (i < query.length) {
+    const ch = query[i];
+
+    if (ch === "#") {
+      while (i < query.length && query[i] !== "\n" && query[i] !== "\r") {
+        ++i;
+      }
+
+      separate = true;
+      continue;
+    }
+
+    if (ch === " " || ch === "\t" || ch === "\n" || ch === "\r" || ch === ",") {
+      separate = true;
+      ++i;
+      continue;
+    }
+
+    if (separate && result.length > 0) {
+      result += " ";
+    }
+
+    separate = false;
+
+    if (ch !== '"') {
+      result += ch;
+      ++i;
+      continue;
+    }
+
+    let end = i + 1;
+
+    if (query.startsWith('"""', i)) {
+      end = i + 3;
+
+      while (end < query.length && !query.startsWith('"""', end)) {
+        end += query.startsWith('\\"""', end) ? 4 : 1;
+      }
+
+      end = Math.min(end + 3, query.length);
+    } else {
+      while (
+        end < query.length &&
+        query[end] !== '"' &&
+        query[end] !== "\n" &&
+        query[end] !== "\r"
+      ) {
+        end += query[end] === "\\" ? 2 : 1;
+      }
+
+      end = Math.min(end + 1, query.length);
+    }
+
+    result += query.slice(i, end);
+    i = end;
+  }
+
+  return result;
+}
+
+// Must match QueryRegistry::Hash: 64-bit FNV-1a of the UTF-8 bytes, using 16-bit limbs so it stays
+// within the precision of a double.
+function hashQuery(normalized) {
+  let h0 = 0x2325;
+  let h1 = 0x8422;
+  let h2 = 0x9ce4;
+  let h3 = 0xcbf2;
+
+  for (const byte of new TextEncoder().encode(normalized)) {
+    h0 ^= byte;
+
+    const t0 = h0 * 0x1b3;
+    let t1 = h1 * 0x1b3;
+    let t2 = h2 * 0x1b3 + h0 * 0x100;
+    let t3 = h3 * 0x1b3 + h1 * 0x100;
+
+    t1 += t0 >>> 16;
+    t2 += t1 >>> 16;
+    t3 += t2 >>> 16;
+    h0 = t0 & 0xffff;
+    h1 = t1 & 0xffff;
+    h2 = t2 & 0xffff;
+    h3 = t3 & 0xffff;
+  }
+
+  return [h3, h2, h1, h0].map((limb) => limb.toString(16).padStart(4, "0")).join("");
+}
+
+// Try to register the query by its hash first, and only send the full text if the main process
+// doesn't know it yet.
+async function parseQuery(query) {
+  const queryId = await ipcRenderer.invoke(
+    "parsePersistedQuery",
+    hashQuery(normalizeQuery(query))
+  );
+
+  return queryId !== null ? queryId : ipcRenderer.invoke("parseQuery", query);
+}
+
 ipcRenderer.on("fetched", (_event, queryId, payload) => {
-  const result = JSON.parse(payload);
+  // External payloads which aren't pure ASCII arrive as a Uint8Array of UTF-8 bytes, and object
+  // payloads are already parsed.
+  const result =
+    typeof payload === "string"
+      ? JSON.parse(payload)
+      : payload instanceof Uint8Array
+      ? JSON.parse(new TextDecoder().decode(payload))
+      : payload;
   _callbacks
     .filter((callback) => callback.queryId === queryId)
     .forEach((callback) => callback.next(result));
@@ -20,11 +133,11 @@ ipcRenderer.on("completed", (_event, queryId) => {
 contextBridge.exposeInMainWorld("graphql", {
   startService: () => ipcRenderer.invoke("startService"),
   stopService: () => ipcRenderer.invoke("stopService"),
-  parseQuery: (query) => ipcRenderer.invoke("parseQuery", query),
+  parseQuery,
   discardQuery: (queryId) => ipcRenderer.invoke("discardQuery", queryId),
-  fetchQuery: (queryId, operationName, variables, next, complete) => {
+  fetchQuery: (queryId, operationName, variables, next, complete, options) => {
     _callbacks.push({ queryId, next, complete });
-    ipcRenderer.send("fetchQuery", queryId, operationName, variables);
+    ipcRenderer.send("fetchQuery", queryId, operationName, variables, options);
   },
   unsubscribe: (queryId) => ipcRenderer.invoke("unsubscribe", queryId),
 });
@@ -3,7 +3,10 @@ describe("GraphQL native module tests", () => {
 
   it("starts the service", () => {
     expect(graphql).not.toBeNull();
-    graphql.startService();
+    for (const resolverThreads of [-1, 1.5, Infinity, 2 ** 32, "2"]) {
+      expect(() => graphql.startService({ resolverThreads })).toThrow();
+    }
+    graphql.startService({ resolverThreads: 2, resolverQueueDepth: 16 });
   });
 
   let queryId = null;
@@ -49,6 +52,129 @@ describe("GraphQL native module tests", () => {
     ).resolves.toMatchSnapshot();
   });
 
+  const fetchWithOutput = (queryId, output, variables = "") =>
+    new Promise((resolve) => {
+      let result = null;
+      graphql.fetchQuery(
+        queryId,
+        "",
+        variables,
+        (payload) => {
+          result = payload;
+        },
+        () => {
+          resolve(result);
+        },
+        { output }
+      );
+    });
+
+  it("fetches introspection with external output", async () => {
+    expect(queryId).not.toBeNull();
+    const copied = await fetchWithOutput(queryId, "string");
+    const external = await fetchWithOutput(queryId, "external");
+    expect(typeof external).toEqual("string");
+    expect(external).toEqual(copied);
+  });
+
+  it("fetches non-ASCII payloads as a Buffer with external output", async () => {
+    const echoId = graphql.parseQuery(`mutation {
+        completeTask(input: {id: "ZmFrZVRhc2tJZA==", clientMutationId: "Grüße ✓"}) {
+            clientMutationId
+        }
+    }`);
+    const copied = await fetchWithOutput(echoId, "string");
+    const external = await fetchWithOutput(echoId, "external");
+    expect(Buffer.isBuffer(external)).toEqual(true);
+    expect(external.toString("utf8")).toEqual(copied);
+    expect(JSON.parse(copied).data.completeTask.clientMutationId).toEqual("Grüße ✓");
+    graphql.discardQuery(echoId);
+  });
+
+  it("fetches introspection with object output", async () => {
+    expect(queryId).not.toBeNull();
+    const copied = await fetchWithOutput(queryId, "string");
+    const result = await fetchWithOutput(queryId, "object");
+    expect(typeof result).toEqual("object");
+    expect(result).toEqual(JSON.parse(copied));
+  });
+
+  it("caches introspection results by variables", async () => {
+    const typeId = graphql.parseQuery(`query ($name: String!) {
+        __typename
+        __type(name: $name) { name kind }
+    }`);
+    const before = graphql.getIntrospectionCacheStats();
+    const task = await fetchWithOutput(typeId, "string", { name: "Task" });
+    const folder = await fetchWithOutput(typeId, "object", { name: "Folder" });
+    const cached = await fetchWithOutput(typeId, "string", { name: "Task" });
+    const after = graphql.getIntrospectionCacheStats();
+    expect(after.misses - before.misses).toEqual(2);
+    expect(after.hits - before.hits).toEqual(1);
+    expect(after.entries - before.entries).toEqual(2);
+    expect(JSON.parse(task)).toEqual({
+      data: { __typename: "Query", __type: { name: "Task", kind: "OBJECT" } },
+    });
+    expect(folder).toEqual({
+      data: { __typename: "Query", __type: { name: "Folder", kind: "OBJECT" } },
+    });
+    expect(cached).toEqual(task);
+    graphql.discardQuery(typeId);
+  });
+
+  it("caches introspection results for variables in any order", async () => {
+    const fieldsId = graphql.parseQuery(`query ($name: String!, $deprecated: Boolean) {
+        __type(name: $name) { fields(includeDeprecated: $deprecated) { name } }
+    }`);
+    const before = graphql.getIntrospectionCacheStats();
+    const first = await fetchWithOutput(fieldsId, "string", { name: "Task", deprecated: true });
+    const reordered = await fetchWithOutput(fieldsId, "string", {
+      deprecated: true,
+      name: "Task",
+    });
+    const fromString = await fetchWithOutput(
+      fieldsId,
+      "string",
+      '{"deprecated":true,"name":"Task"}'
+    );
+    const after = graphql.getIntrospectionCacheStats();
+    expect(after.misses - before.misses).toEqual(1);
+    expect(after.hits - before.hits).toEqual(2);
+    expect(reordered).toEqual(first);
+    expect(fromString).toEqual(first);
+    graphql.discardQuery(fieldsId);
+  });
+
+  it("doesn't cache introspection results with errors", async () => {
+    const typeId = graphql.parseQuery(`query ($name: String!) {
+        __type(name: $name) { name }
+    }`);
+    const before = graphql.getIntrospectionCacheStats();
+    const first = JSON.parse(await fetchWithOutput(typeId, "string", {}));
+    const second = JSON.parse(await fetchWithOutput(typeId, "string", {}));
+    const after = graphql.getIntrospectionCacheStats();
+    expect(first.errors.length).toBeGreaterThan(0);
+    expect(second).toEqual(first);
+    expect(after.misses - before.misses).toEqual(2);
+    expect(after.hits).toEqual(before.hits);
+    expect(after.entries).toEqual(before.entries);
+    graphql.discardQuery(typeId);
+  });
+
+  it("resolves introspection mixed with other root fields", async () => {
+    const mixedId = graphql.parseQuery(`query {
+        __schema { queryType { name } }
+        __type(name: "Task") { name }
+        appointments { edges { node { id } } }
+    }`);
+    const result = JSON.parse(await fetchWithOutput(mixedId, "string"));
+    expect(result.errors).toBeUndefined();
+    expect(result.data.__schema.queryType.name).toEqual("Query");
+    expect(result.data.__type.name).toEqual("Task");
+    expect(result.data.appointments.edges.length).toBeGreaterThan(0);
+    graphql.discardQuery(mixedId);
+  });
+
   it("cleans up after the query", () => {
     expect(queryId).not.toBeNull();
     graphql.unsubscribe(queryId);
@@ -56,6 +182,222 @@ describe("GraphQL native module tests", () => {
     queryId = null;
   });
 
+  it("shares parsed documents by hash", () => {
+    const first = graphql.parseQuery(`query { appointments { edges { node { id } } } }`);
+    const second = graphql.parseQuery(`query {
+        # Same document, different formatting
+        appointments { edges { node { id } } }
+    }`);
+    expect(second).not.toEqual(first);
+    const hash = graphql.getQueryHash(first);
+    expect(graphql.getQueryHash(second)).toEqual(hash);
+    const persisted = graphql.parsePersistedQuery(hash);
+    expect(persisted).not.toBeNull();
+    expect(graphql.parsePersistedQuery("0000000000000000")).toBeNull();
+    [first, second, persisted].forEach((id) => graphql.discardQuery(id));
+  });
+
+  it("parses queries asynchronously", async () => {
+    const queryText = `query { tasks { edges { node { id title } } } }`;
+    const [first, second] = await Promise.all([
+      graphql.parseQueryAsync(queryText),
+      graphql.parseQueryAsync(queryText),
+    ]);
+    expect(second).not.toEqual(first);
+    expect(graphql.getQueryHash(second)).toEqual(graphql.getQueryHash(first));
+    await expect(graphql.parseQueryAsync(`query { unknownField }`)).rejects.toThrow();
+    [first, second].forEach((id) => graphql.discardQuery(id));
+  });
+
+  it("accepts variables as objects", async () => {
+    const tasksId = graphql.parseQuery(`query ($ids: [ID!]!) {
+        tasksById(ids: $ids) { id title }
+    }`);
+    const ids = ["ZmFrZVRhc2tJZA=="];
+    const fromString = await fetchWithOutput(tasksId, "string", JSON.stringify({ ids }));
+    const fromObject = await fetchWithOutput(tasksId, "string", { ids });
+    const fromBytes = await fetchWithOutput(tasksId, "string", {
+      ids: [Buffer.from("fakeTaskId")],
+    });
+    expect(JSON.parse(fromString).data.tasksById).toHaveLength(1);
+    expect(fromObject).toEqual(fromString);
+    expect(fromBytes).toEqual(fromString);
+    graphql.discardQuery(tasksId);
+  });
+
+  it("converts or rejects variables which JSON.stringify would", async () => {
+    const echoId = graphql.parseQuery(`mutation ($clientMutationId: String) {
+        completeTask(input: {id: "ZmFrZVRhc2tJZA==", clientMutationId: $clientMutationId}) {
+            clientMutationId
+        }
+    }`);
+    const when = new Date(0);
+    const fromDate = await fetchWithOutput(echoId, "object", { clientMutationId: when });
+    expect(fromDate.data.completeTask.clientMutationId).toEqual(when.toISOString());
+    const cyclic = { clientMutationId: "cyclic" };
+    cyclic.self = cyclic;
+    expect(() => graphql.fetchQuery(echoId, "", cyclic, () => {}, () => {})).toThrow();
+    let nested = {};
+    for (let i = 0; i < 100000; ++i) {
+      nested = { nested };
+    }
+    expect(() => graphql.fetchQuery(echoId, "", nested, () => {}, () => {})).toThrow();
+    const getter = {
+      get clientMutationId() {
+        throw new Error("getter");
+      },
+    };
+    expect(() => graphql.fetchQuery(echoId, "", getter, () => {}, () => {})).toThrow(
+      /variables\.clientMutationId threw: Error: getter/
+    );
+    const trap = new Proxy(
+      {},
+      {
+        ownKeys() {
+          throw new Error("ownKeys");
+        },
+      }
+    );
+    expect(() => graphql.fetchQuery(echoId, "", trap, () => {}, () => {})).toThrow(/ownKeys/);
+    for (const notFinite of [NaN, Infinity, -Infinity]) {
+      const variables = { clientMutationId: notFinite };
+      const fromObject = await fetchWithOutput(echoId, "string", variables);
+      const fromString = await fetchWithOutput(
+        echoId,
+        "string",
+        JSON.stringify(variables)
+      );
+      expect(fromObject).toEqual(fromString);
+      expect(JSON.parse(fromObject).data.completeTask.clientMutationId).toBeNull();
+    }
+    graphql.discardQuery(echoId);
+  });
+
+  it("pages connections with cursors", async () => {
+    const pageId = graphql.parseQuery(`query ($after: ItemCursor) {
+        tasks(first: 1, after: $after) {
+          pageInfo { hasNextPage hasPreviousPage }
+          edges { cursor node { id } }
+        }
+    }`);
+    const first = JSON.parse(await fetchWithOutput(pageId, "string")).data.tasks;
+    expect(first.edges).toHaveLength(1);
+    const { cursor } = first.edges[0];
+    expect(cursor).not.toEqual(first.edges[0].node.id);
+    const after = JSON.parse(await fetchWithOutput(pageId, "string", { after: cursor })).data;
+    expect(after.tasks).toEqual(first);
+    const byId = JSON.parse(
+      await fetchWithOutput(pageId, "string", { after: first.edges[0].node.id })
+    ).data;
+    expect(byId.tasks.edges[0].node).toEqual(first.edges[0].node);
+    const unknown = JSON.parse(
+      await fetchWithOutput(pageId, "string", { after: "bm90QUN1cnNvcg==" })
+    ).data;
+    expect(unknown.tasks).toEqual(first);
+    graphql.discardQuery(pageId);
+  });
+
+  it("delivers root selections incrementally", async () => {
+    const incrementalId = graphql.parseQuery(`query {
+        testTaskState
+        node(id: "ZmFrZVRhc2tJZA==") { id }
+    }`);
+    const payloads = await new Promise((resolve) => {
+      const results = [];
+      graphql.fetchQuery(
+        incrementalId,
+        "",
+        "",
+        (payload) => {
+          results.push(payload);
+        },
+        () => {
+          resolve(results);
+        },
+        { output: "object", incremental: true }
+      );
+    });
+    expect(payloads).toHaveLength(2);
+    expect(payloads[0].hasNext).toEqual(true);
+    expect(payloads[1].hasNext).toEqual(false);
+    expect(payloads[1].incremental[0].path).toEqual([]);
+    const data = { ...payloads[0].data, ...payloads[1].incremental[0].data };
+    expect(data.testTaskState).toBeDefined();
+    expect(data.node).toEqual({ id: "ZmFrZVRhc2tJZA==" });
+    graphql.discardQuery(incrementalId);
+  });
+
+  const fetchAll = (queryId, options) =>
+    new Promise((resolve) => {
+      const results = [];
+      graphql.fetchQuery(
+        queryId,
+        "",
+        "",
+        (payload) => {
+          results.push(payload);
+        },
+        () => {
+          resolve(results);
+        },
+        { output: "object", ...options }
+      );
+    });
+
+  it("delivers errors from incremental root selections", async () => {
+    const failingId = graphql.parseQuery(`query {
+        testTaskState
+        tasks(first: -1) { edges { node { id } } }
+    }`);
+    const payloads = await fetchAll(failingId, { incremental: true });
+    expect(payloads).toHaveLength(2);
+    expect(payloads[1].hasNext).toEqual(false);
+    const errors = payloads.flatMap((payload) =>
+      payload.incremental ? payload.incremental[0].errors || [] : payload.errors || []
+    );
+    expect(errors.length).toBeGreaterThan(0);
+    graphql.discardQuery(failingId);
+    const unknown = await fetchAll(-1, {});
+    expect(unknown).toHaveLength(1);
+    expect(unknown[0].errors.length).toBeGreaterThan(0);
+  });
+
+  it("doesn't split root selections which share a response key", async () => {
+    const duplicateId = graphql.parseQuery(`query {
+        task: node(id: "ZmFrZVRhc2tJZA==") { id }
+        task: node(id: "ZmFrZVRhc2tJZA==") { ...on Task { title } }
+    }`);
+    const payloads = await fetchAll(duplicateId, { incremental: true });
+    expect(payloads).toHaveLength(1);
+    expect(payloads[0].hasNext).toBeUndefined();
+    expect(payloads[0].data.task).toEqual({ id: "ZmFrZVRhc2tJZA==", title: "Don't forget" });
+    graphql.discardQuery(duplicateId);
+  });
+
+  it("reuses the split root selections for the same document", async () => {
+    const splitId = graphql.parseQuery(`query {
+        testTaskState
+        node(id: "ZmFrZVRhc2tJZA==") { id }
+    }`);
+    const duplicateId = graphql.parseQuery(`query {
+        task: node(id: "ZmFrZVRhc2tJZA==") { id }
+        task: node(id: "ZmFrZVRhc2tJZA==") { id }
+    }`);
+    for (const [queryId, expected] of [
+      [splitId, 2],
+      [duplicateId, 1],
+    ]) {
+      const first = await fetchAll(queryId, { incremental: true });
+      const second = await fetchAll(queryId, { incremental: true });
+      expect(first).toHaveLength(expected);
+      expect(second).toHaveLength(expected);
+      expect(second.map((payload) => payload.hasNext)).toEqual(
+        first.map((payload) => payload.hasNext)
+      );
+    }
+    [splitId, duplicateId].forEach((id) => graphql.discardQuery(id));
+  });
+
   let subscriptionId = null;
 
   it("parses subscription", () => {
@@ -128,7 +470,8 @@ describe("GraphQL native module tests", () => {
           },
           () => {
             resolve(result);
-          }
+          },
+          { awaitDelivery: true }
         );
       })
     ).resolves.toMatchSnapshot();
@@ -141,9 +484,9 @@ describe("GraphQL native module tests", () => {
     mutationId = null;
   });
 
-  it("updates subscriptions", () => {
+  it("updates subscriptions", async () => {
     expect(subscriptionPromise).not.toBeNull();
-    expect(subscriptionPromise).resolves.toMatchSnapshot();
+    await expect(subscriptionPromise).resolves.toMatchSnapshot();
   });
 
   it("cleans up after the subscription", async () => {
@@ -157,6 +500,328 @@ describe("GraphQL native module tests", () => {
     subscriptionId = null;
   });
 
+  it("holds a mutation with awaitDelivery until its event is delivered", async () => {
+    const watchId = graphql.parseQuery(`subscription {
+        nodeChange(id: "ZmFrZVRhc2tJZA==") {
+            id
+        }
+    }`);
+    const completeId = graphql.parseQuery(`mutation {
+        completeTask(input: {id: "ZmFrZVRhc2tJZA==", isComplete: true}) {
+            clientMutationId
+        }
+    }`);
+    const order = [];
+    const watchNext = new Promise((resolve) => {
+      graphql.fetchQuery(
+        watchId,
+        "",
+        "",
+        () => {
+          order.push("next");
+          resolve();
+        },
+        () => {}
+      );
+    });
+
+    for (let i = 0; i < 10; ++i) {
+      await new Promise((resolve) => {
+        graphql.fetchQuery(
+          completeId,
+          "",
+          "",
+          () => {
+            order.push("mutation");
+          },
+          resolve,
+          { awaitDelivery: true }
+        );
+      });
+    }
+
+    // Each mutation's payload only arrives after the subscription's payload for its event.
+    await watchNext;
+    expect(order).toEqual(new Array(10).fill(["next", "mutation"]).flat());
+    graphql.unsubscribe(watchId);
+    graphql.discardQuery(watchId);
+    graphql.discardQuery(completeId);
+  });
+
+  it("only delivers a nodeChange to the subscriptions for that id", async () => {
+    const taskWatchId = graphql.parseQuery(`subscription {
+        nodeChange(id: "ZmFrZVRhc2tJZA==") {
+            id
+        }
+    }`);
+    const folderWatchId = graphql.parseQuery(`subscription {
+        nodeChange(id: "ZmFrZUZvbGRlcklk") {
+            id
+        }
+    }`);
+    const completeId = graphql.parseQuery(`mutation {
+        completeTask(input: {id: "ZmFrZVRhc2tJZA==", isComplete: true}) {
+            clientMutationId
+        }
+    }`);
+    const received = [];
+    const watch = (queryId) =>
+      graphql.fetchQuery(
+        queryId,
+        "",
+        "",
+        (payload) => {
+          received.push(JSON.parse(payload).data.nodeChange.id);
+        },
+        () => {}
+      );
+
+    watch(taskWatchId);
+    watch(folderWatchId);
+    await new Promise((resolve) => {
+      graphql.fetchQuery(completeId, "", "", () => {}, resolve, { awaitDelivery: true });
+    });
+
+    // awaitDelivery flushes every matching subscription before the mutation completes.
+    expect(received).toEqual(["ZmFrZVRhc2tJZA=="]);
+    for (const queryId of [taskWatchId, folderWatchId]) {
+      graphql.unsubscribe(queryId);
+      graphql.discardQuery(queryId);
+    }
+    graphql.discardQuery(completeId);
+  });
+
+  it("traces requests in extensions", async () => {
+    const tracedId = graphql.parseQuery(`query { tasks { edges { node { id } } } }`);
+    const payload = await new Promise((resolve) => {
+      let result = null;
+      graphql.fetchQuery(
+        tracedId,
+        "",
+        "",
+        (payload) => {
+          result = JSON.parse(payload);
+        },
+        () => {
+          resolve(result);
+        },
+        { tracing: true }
+      );
+    });
+    expect(payload.data.tasks.edges).toHaveLength(1);
+    const tracing = payload.extensions.tracing;
+    expect(tracing.version).toEqual(1);
+    expect(tracing.duration).toBeGreaterThan(0);
+    for (const stage of ["parsing", "validation", "execution", "serialization", "delivery"]) {
+      expect(typeof tracing[stage].startOffset).toEqual("number");
+      expect(typeof tracing[stage].duration).toEqual("number");
+    }
+    const resolvers = tracing.execution.resolvers;
+    expect(resolvers).toContainEqual(
+      expect.objectContaining({
+        path: ["tasks"],
+        parentType: "Query",
+        fieldName: "tasks",
+        returnType: "TaskConnection",
+      })
+    );
+    expect(resolvers).toContainEqual(
+      expect.objectContaining({
+        path: ["tasks", "edges", 0, "node"],
+        parentType: "TaskEdge",
+        fieldName: "node",
+        returnType: "Task",
+      })
+    );
+    graphql.discardQuery(tracedId);
+  });
+
+  it("caches responses until a mutation invalidates them", async () => {
+    // Only this test runs with the cache, so the others always resolve their queries.
+    graphql.stopService();
+    graphql.startService({
+      resolverThreads: 2,
+      resolverQueueDepth: 16,
+      responseCacheBytes: 1024 * 1024,
+    });
+    const tasksId = graphql.parseQuery(`query { tasks { edges { node { id title } } } }`);
+    const appointmentsId = graphql.parseQuery(`query { appointments { edges { node { id } } } }`);
+    const completeId = graphql.parseQuery(`mutation {
+        completeTask(input: {id: "ZmFrZVRhc2tJZA=="}) { clientMutationId }
+    }`);
+    const before = graphql.getResponseCacheStats();
+    const first = await fetchWithOutput(tasksId, "string");
+    await fetchWithOutput(appointmentsId, "string");
+    expect(await fetchWithOutput(tasksId, "string")).toEqual(first);
+    await fetchWithOutput(appointmentsId, "string");
+    const cached = graphql.getResponseCacheStats();
+    expect(cached.hits - before.hits).toEqual(2);
+    expect(cached.misses - before.misses).toEqual(2);
+    await fetchWithOutput(completeId, "string");
+    const invalidated = graphql.getResponseCacheStats();
+    expect(invalidated.invalidations - cached.invalidations).toEqual(1);
+    expect(await fetchWithOutput(tasksId, "object")).toEqual(JSON.parse(first));
+    await fetchWithOutput(appointmentsId, "string");
+    const after = graphql.getResponseCacheStats();
+    expect(after.misses - invalidated.misses).toEqual(1);
+    expect(after.hits - invalidated.hits).toEqual(1);
+    expect(after.bytes).toBeLessThanOrEqual(1024 * 1024);
+    // A hit with object output gets the cached document.
+    expect(await fetchWithOutput(tasksId, "object")).toEqual(JSON.parse(first));
+    expect(graphql.getResponseCacheStats().hits - after.hits).toEqual(1);
+    [tasksId, appointmentsId, completeId].forEach((id) => graphql.discardQuery(id));
+    graphql.stopService();
+    graphql.startService({ resolverThreads: 2, resolverQueueDepth: 16 });
+  });
+
+  it("reports metrics", async () => {
+    const metricsId = graphql.parseQuery(`query { tasks { edges { node { id title } } } }`);
+    await fetchWithOutput(metricsId, "object");
+    const metrics = graphql.getMetrics();
+    expect(metrics.stages.parse.document.count).toBeGreaterThan(0);
+    expect(metrics.stages.execute.query.count).toBeGreaterThan(0);
+    expect(metrics.stages.execute.query.p99).toBeGreaterThanOrEqual(
+      metrics.stages.execute.query.p50
+    );
+    expect(metrics.executors.resolver.threads).toBeGreaterThan(0);
+    expect(typeof metrics.subscriptions).toEqual("number");
+    const text = graphql.getMetrics("text");
+    expect(text).toContain(
+      'cppgraphql_stage_duration_seconds_count{stage="execute",operation="query"}'
+    );
+    expect(text).toContain('cppgraphql_executor_threads{executor="resolver"}');
+    graphql.discardQuery(metricsId);
+  });
+
+  it("validates subscription queue options", () => {
+    const stateId = graphql.parseQuery(`query { testTaskState }`);
+    expect(() =>
+      graphql.fetchQuery(stateId, "", "", () => {}, () => {}, { overflow: "bogus" })
+    ).toThrow();
+    for (const capacity of [-1, 1.5, Infinity, NaN, 2 ** 64, "2"]) {
+      expect(() =>
+        graphql.fetchQuery(stateId, "", "", () => {}, () => {}, { capacity })
+      ).toThrow();
+    }
+    graphql.discardQuery(stateId);
+    const stats = graphql.getSubscriptionStats();
+    expect(typeof stats.dropped).toEqual("number");
+    expect(typeof stats.conflated).toEqual("number");
+  });
+
+  // Queue up more change events than the subscription's capacity while the main thread is busy, so
+  // none of the payloads can be acknowledged until they've all been delivered to the queue.
+  const overflowSubscription = async (capacity, overflow, events, expected) => {
+    const nodeChangeId = graphql.parseQuery(`subscription {
+        nodeChange(id: "ZmFrZVRhc2tJZA==") { id }
+    }`);
+    const completeId = graphql.parseQuery(`mutation {
+        completeTask(input: {id: "ZmFrZVRhc2tJZA=="}) { clientMutationId }
+    }`);
+    const payloads = [];
+    let completed = null;
+    const subscriptionCompleted = new Promise((resolve) => {
+      completed = resolve;
+    });
+    graphql.fetchQuery(
+      nodeChangeId,
+      "",
+      "",
+      (payload) => payloads.push(JSON.parse(payload)),
+      completed,
+      { capacity, overflow }
+    );
+    const before = graphql.getSubscriptionStats();
+    const mutations = [];
+    for (let i = 0; i < events; ++i) {
+      mutations.push(fetchWithOutput(completeId, "string"));
+    }
+    const busyUntil = Date.now() + 500;
+    while (Date.now() < busyUntil) {
+      // Keep the main thread from acknowledging any payloads.
+    }
+    await Promise.all(mutations);
+    const deadline = Date.now() + 5000;
+    while (payloads.length < expected && Date.now() < deadline) {
+      await new Promise((resolve) => setTimeout(resolve, 50));
+    }
+    // Give anything past the expected count a chance to show up.
+    await new Promise((resolve) => setTimeout(resolve, 100));
+    const after = graphql.getSubscriptionStats();
+    graphql.unsubscribe(nodeChangeId);
+    await subscriptionCompleted;
+    [nodeChangeId, completeId].forEach((id) => graphql.discardQuery(id));
+    return {
+      payloads,
+      dropped: after.dropped - before.dropped,
+      conflated: after.conflated - before.conflated,
+    };
+  };
+
+  it("drops the oldest payloads when the queue is full", async () => {
+    const result = await overflowSubscription(2, "dropOldest", 6, 2);
+    expect(result.payloads).toHaveLength(2);
+    expect(result.payloads[0]).toEqual({ data: { nodeChange: { id: "ZmFrZVRhc2tJZA==" } } });
+    expect(result.dropped).toEqual(4);
+    expect(result.conflated).toEqual(0);
+  });
+
+  it("conflates payloads for the same node with latestWins", async () => {
+    const result = await overflowSubscription(2, "latestWins", 6, 2);
+    expect(result.payloads).toHaveLength(2);
+    expect(result.dropped + result.conflated).toEqual(4);
+  });
+
+  it("blocks the producer instead of dropping payloads", async () => {
+    const result = await overflowSubscription(2, "block", 6, 6);
+    expect(result.payloads).toHaveLength(6);
+    expect(result.dropped).toEqual(0);
+    expect(result.conflated).toEqual(0);
+  });
+
+  it("runs in several worker threads", async () => {
+    const { Worker } = require("worker_threads");
+    const modulePath = require("bindings")({
+      bindings: "electron-cppgraphql.node",
+      path: true,
+    });
+    const runWorker = () =>
+      new Promise((resolve, reject) => {
+        const worker = new Worker(
+          `const { parentPort, workerData } = require("worker_threads");
+          const graphql = require(workerData.modulePath);
+          graphql.startService({ resolverThreads: 2 });
+          const queryId = graphql.parseQuery(
+            "query { appointments { edges { node { subject } } } }"
+          );
+          let result = null;
+          graphql.fetchQuery(
+            queryId,
+            "",
+            "",
+            (payload) => {
+              result = payload;
+            },
+            () => {
+              graphql.discardQuery(queryId);
+              graphql.stopService();
+              parentPort.postMessage(result);
+            }
+          );`,
+          { eval: true, workerData: { modulePath } }
+        );
+        worker.once("message", resolve);
+        worker.once("error", reject);
+      });
+    const results = await Promise.all([runWorker(), runWorker(), runWorker(), runWorker()]);
+    expect(JSON.parse(results[0])).toEqual({
+      data: { appointments: { edges: [{ node: { subject: "Lunch?" } }] } },
+    });
+    for (const result of results) {
+      expect(result).toEqual(results[0]);
+    }
+  });
+
   it("stops the service", () => {
     graphql.stopService();
   });
@@ -0,0 +1,243 @@
+#include "TodayMock.h"
+
+#include "graphqlservice/JSONResponse.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace graphql;
+
+namespace {
+
+// Large enough that a lookup which scans the list instead of hashing the id takes seconds.
+constexpr int TaskCount = 1'000'000;
+
+int failures = 0;
+
+void check(bool condition, const char* message)
+{
+	if (!condition)
+	{
+		std::cerr << "FAILED: " << message << std::endl;
+		++failures;
+	}
+}
+
+response::IdType makeId(std::string_view prefix, int index)
+{
+	const auto text = std::string { prefix } + std::to_string(index);
+	response::IdType id(text.size());
+
+	std::copy(text.cbegin(), text.cend(), id.begin());
+
+	return id;
+}
+
+std::vector<std::shared_ptr<today::Task>> makeTasks()
+{
+	std::vector<std::shared_ptr<today::Task>> tasks;
+
+	tasks.reserve(TaskCount);
+
+	for (int i = 0; i < TaskCount; ++i)
+	{
+		tasks.push_back(
+			std::make_shared<today::Task>(makeId("task", i), "Task " + std::to_string(i), false));
+	}
+
+	return tasks;
+}
+
+// Every task is found by its own id, whether the id is still bytes or an opaque base64 string
+// which wasn't decoded yet, and ids which aren't there or belong to another type aren't.
+void testStoreLookups(const std::vector<std::shared_ptr<today::Task>>& tasks)
+{
+	today::EntityStore store;
+
+	store.Add(tasks);
+
+	check(store.size() == tasks.size(), "store holds every task");
+
+	bool allFound = true;
+
+	for (const auto& task : tasks)
+	{
+		allFound = allFound && store.Find<today::Task>(task->id()) == task;
+	}
+
+	check(allFound, "every task is found by its id");
+	check(store.Find<today::Task>(response::IdType { std::string { "dGFzazA=" } }) == tasks.front(),
+		"an opaque id finds the first task");
+	check(store.Find<today::Task>(response::IdType { std::string { "dGFzazk5OTk5OQ==" } })
+			== tasks.back(),
+		"an opaque id finds the last task");
+	check(!store.Find(makeId("task", TaskCount)), "an id past the end isn't found");
+	check(!store.Find<today::Appointment>(makeId("task", 0)),
+		"a task isn't found as an Appointment");
+}
+
+std::shared_ptr<today::Operations> buildService(std::vector<std::shared_ptr<today::Task>> tasks,
+	today::Query::nodeTypeLookup&& getNodeType = {})
+{
+	auto query = std::make_shared<today::Query>(
+		[]() -> std::vector<std::shared_ptr<today::Appointment>> {
+			return { std::make_shared<today::Appointment>(makeId("appointment", 0),
+				"tomorrow",
+				"Appointment 0",
+				true) };
+		},
+		[tasks = std::move(tasks)]() {
+			return tasks;
+		},
+		[]() -> std::vector<std::shared_ptr<today::Folder>> {
+			return { std::make_shared<today::Folder>(makeId("folder", 0), "Inbox", 3) };
+		},
+		std::move(getNodeType));
+	auto mutation = std::make_shared<today::Mutation>(
+		[](const std::shared_ptr<service::RequestState>&,
+			today::CompleteTaskInput&&) -> std::shared_ptr<today::CompleteTaskPayload> {
+			return nullptr;
+		});
+
+	return std::make_shared<today::Operations>(std::move(query),
+		std::move(mutation),
+		std::shared_ptr<today::Subscription> {});
+}
+
+// tasksById finds ids spread across the whole list, including the last one.
+void testTasksById(today::Operations& service)
+{
+	constexpr int count = 1'000;
+	auto ast = peg::parseString(R"gql(query ($ids: [ID!]!) { tasksById(ids: $ids) { title } })gql");
+	response::Value ids(response::Type::List);
+	response::Value variables(response::Type::Map);
+
+	for (int i = 0; i < count; ++i)
+	{
+		ids.emplace_back(response::Value(makeId("task",
+			TaskCount - 1 - static_cast<int>(static_cast<std::int64_t>(i) * TaskCount / count))));
+	}
+
+	variables.emplace_back("ids", std::move(ids));
+
+	auto result = service.resolve({ ast, {}, std::move(variables) }).get();
+	const auto& tasks = result["data"]["tasksById"];
+
+	check(result.find("errors") == result.end(), "tasksById has no errors");
+	check(tasks.type() == response::Type::List && tasks.size() == count,
+		"tasksById returns a result for each id");
+
+	if (tasks.type() == response::Type::List && tasks.size() == count)
+	{
+		const auto& list = tasks.get<response::ListType>();
+
+		check(std::all_of(list.cbegin(),
+				  list.cend(),
+				  [](const response::Value& task) {
+					  return task.type() == response::Type::Map;
+				  }),
+			"tasksById finds every id");
+		check(list.front()["title"].get<std::string>() == "Task 999999",
+			"tasksById finds the last task");
+	}
+}
+
+struct NodeCase
+{
+	std::shared_ptr<today::RequestState> state;
+	response::Value result;
+};
+
+NodeCase resolveNode(today::Operations& service, response::IdType id)
+{
+	auto ast = peg::parseString(R"gql(query ($id: ID!) { node(id: $id) {
+		... on Appointment { subject }
+		... on Folder { name }
+	} })gql");
+	response::Value variables(response::Type::Map);
+	auto state = std::make_shared<today::RequestState>(1);
+
+	variables.emplace_back("id", response::Value(std::move(id)));
+
+	auto result = service
+					  .resolve({ ast, {}, std::move(variables), service::await_async {}, state })
+					  .get();
+
+	return { std::move(state), std::move(result) };
+}
+
+// Without a node type lookup, node(id:) can't tell which list owns the id, so the first one loads
+// all of them, and then it's a single lookup in the EntityStore.
+void testNodeLoadsEveryList(today::Operations& service)
+{
+	const auto appointment = resolveNode(service, makeId("appointment", 0));
+	const auto& subject = appointment.result["data"]["node"]["subject"];
+
+	check(subject.type() == response::Type::String
+			&& subject.get<std::string>() == "Appointment 0",
+		"node finds the appointment");
+	check(appointment.state->loadAppointmentsCount == 1, "node loads the appointments");
+	check(appointment.state->loadTasksCount == 1, "node loads the tasks");
+	check(appointment.state->loadUnreadCountsCount == 1, "node loads the folders");
+
+	const auto folder = resolveNode(service, makeId("folder", 0));
+	const auto& name = folder.result["data"]["node"]["name"];
+
+	check(name.type() == response::Type::String && name.get<std::string>() == "Inbox",
+		"node finds the folder");
+	check(folder.state->loadAppointmentsCount == 0 && folder.state->loadTasksCount == 0
+			&& folder.state->loadUnreadCountsCount == 0,
+		"node doesn't load the lists again");
+}
+
+// With a node type lookup, node(id:) only loads the list which owns the id, and an id the lookup
+// doesn't know isn't a node, without loading anything.
+void testNodeLoadsOwningList(const std::vector<std::shared_ptr<today::Task>>& tasks)
+{
+	const auto folderId = makeId("folder", 0);
+	auto service = buildService(tasks,
+		[folderId](const response::IdType& id) -> std::optional<today::NodeType> {
+			return id == folderId ? std::make_optional(today::NodeType::Folder) : std::nullopt;
+		});
+
+	const auto missing = resolveNode(*service, makeId("appointment", 0));
+
+	check(missing.result["data"]["node"].type() == response::Type::Null,
+		"node is null for an id the lookup doesn't know");
+	check(missing.state->loadAppointmentsCount == 0 && missing.state->loadTasksCount == 0
+			&& missing.state->loadUnreadCountsCount == 0,
+		"node doesn't load anything for an id the lookup doesn't know");
+
+	const auto folder = resolveNode(*service, folderId);
+	const auto& name = folder.result["data"]["node"]["name"];
+
+	check(name.type() == response::Type::String && name.get<std::string>() == "Inbox",
+		"node finds the folder through the lookup");
+	check(folder.state->loadUnreadCountsCount == 1, "node loads the folders");
+	check(folder.state->loadAppointmentsCount == 0, "node doesn't load the appointments");
+	check(folder.state->loadTasksCount == 0, "node doesn't load the million tasks");
+}
+
+} // namespace
+
+int main()
+{
+	auto tasks = makeTasks();
+
+	testStoreLookups(tasks);
+	testNodeLoadsOwningList(tasks);
+
+	auto service = buildService(std::move(tasks));
+
+	// Each list is only loaded once per Query, so this has to run before anything loads them.
+	testNodeLoadsEveryList(*service);
+	testTasksById(*service);
+
+	return failures == 0 ? 0 : 1;
+}
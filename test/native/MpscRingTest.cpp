@@ -0,0 +1,137 @@
+#include "MpscRing.h"
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* message)
+{
+	if (!condition)
+	{
+		std::cerr << "FAILED: " << message << std::endl;
+		++failures;
+	}
+}
+
+// Push and pop one at a time, then in bursts which fill the ring, so the positions wrap around the
+// slots many times.
+void testOrderAcrossWraparound()
+{
+	MpscRing<int> ring { 4 };
+	int next = 0;
+	int expected = 0;
+
+	check(ring.Capacity() == 4, "capacity is rounded to a power of 2");
+
+	for (int round = 0; round < 100; ++round)
+	{
+		const auto burst = round % 5;
+
+		for (int i = 0; i < burst && ring.TryPush(int { next }); ++i)
+		{
+			++next;
+		}
+
+		while (auto value = ring.TryPop())
+		{
+			check(*value == expected++, "values come out in the order they went in");
+		}
+
+		check(ring.Empty(), "ring is empty after it's drained");
+	}
+
+	check(expected == next, "every value came out");
+}
+
+// A full ring rejects the push without consuming the value, so the caller can queue it somewhere
+// else, and accepts pushes again as soon as the consumer frees a slot.
+void testFullRingFallback()
+{
+	MpscRing<std::unique_ptr<int>> ring { 2 };
+
+	check(ring.TryPush(std::make_unique<int>(0)), "first push fits");
+	check(ring.TryPush(std::make_unique<int>(1)), "second push fits");
+	check(ring.Size() == 2, "size counts both values");
+
+	auto rejected = std::make_unique<int>(2);
+
+	check(!ring.TryPush(std::move(rejected)), "push to a full ring fails");
+	check(rejected && *rejected == 2, "a rejected value isn't consumed");
+
+	auto first = ring.TryPop();
+
+	check(first && *first && **first == 0, "oldest value comes out first");
+	check(ring.TryPush(std::move(rejected)), "push fits after a pop");
+
+	auto second = ring.TryPop();
+	auto third = ring.TryPop();
+
+	check(second && *second && **second == 1, "second value comes out next");
+	check(third && *third && **third == 2, "retried value comes out last");
+	check(!ring.TryPop(), "nothing left");
+}
+
+// Several producers push their own increasing sequences, retrying while the ring is full. The
+// consumer has to see every value, and each producer's values in order.
+void testProducerOrder()
+{
+	constexpr std::uint64_t producerCount = 8;
+	constexpr std::uint64_t perProducer = 100'000;
+	MpscRing<std::uint64_t> ring { 16 };
+	std::vector<std::thread> producers;
+	std::vector<std::uint64_t> nextByProducer(producerCount, 0);
+	std::uint64_t received = 0;
+	bool ordered = true;
+
+	for (std::uint64_t producer = 0; producer < producerCount; ++producer)
+	{
+		producers.emplace_back([&ring, producer]() {
+			for (std::uint64_t i = 0; i < perProducer; ++i)
+			{
+				while (!ring.TryPush(producer * perProducer + i))
+				{
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+
+	while (received < producerCount * perProducer)
+	{
+		while (auto value = ring.TryPop())
+		{
+			const auto producer = *value / perProducer;
+
+			ordered = ordered && *value % perProducer == nextByProducer[producer]++;
+			++received;
+		}
+
+		// Let the producers refill it, even if they share a core with the consumer.
+		std::this_thread::yield();
+	}
+
+	for (auto& thread : producers)
+	{
+		thread.join();
+	}
+
+	check(ordered, "each producer's values come out in order");
+	check(ring.Empty(), "ring is empty after every value came out");
+}
+
+} // namespace
+
+int main()
+{
+	testOrderAcrossWraparound();
+	testFullRingFallback();
+	testProducerOrder();
+
+	return failures == 0 ? 0 : 1;
+}
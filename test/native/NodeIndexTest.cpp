@@ -0,0 +1,203 @@
+#include "NodeIndex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace graphql;
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* message)
+{
+	if (!condition)
+	{
+		std::cerr << "FAILED: " << message << std::endl;
+		++failures;
+	}
+}
+
+response::IdType makeId(std::string_view prefix, int index)
+{
+	const auto text = std::string { prefix } + std::to_string(index);
+	response::IdType id(text.size());
+
+	std::copy(text.cbegin(), text.cend(), id.begin());
+
+	return id;
+}
+
+response::IdType makeOpaqueId(std::string_view text)
+{
+	return response::IdType { std::string { text } };
+}
+
+std::shared_ptr<today::object::Node> makeTaskNode(const response::IdType& id)
+{
+	return std::make_shared<today::object::Node>(std::make_shared<today::object::Task>(
+		std::make_shared<today::Task>(response::IdType { id }, "Task", false)));
+}
+
+// Each entry keeps the type it was inserted with, and an id is found whether it's passed as bytes
+// or as the base64 string of those bytes, but not as some other string.
+void testLookups()
+{
+	NodeIndex index;
+	const auto appointment = std::make_shared<today::object::Node>(
+		std::make_shared<today::object::Appointment>(std::make_shared<today::Appointment>(
+			makeId("appointment", 0),
+			"tomorrow",
+			"Lunch?",
+			false)));
+	const auto task = makeTaskNode(makeId("task", 0));
+	const auto folder =
+		std::make_shared<today::object::Node>(std::make_shared<today::object::Folder>(
+			std::make_shared<today::Folder>(makeId("folder", 0), "Inbox", 3)));
+
+	index.Insert(makeId("appointment", 0), NodeIndex::NodeType::Appointment, appointment);
+	index.Insert(makeId("task", 0), NodeIndex::NodeType::Task, task);
+
+	// "folder0" as base64, it's stored as the bytes it encodes.
+	index.Insert(makeOpaqueId("Zm9sZGVyMA=="), NodeIndex::NodeType::Folder, folder);
+
+	check(index.size() == 3, "index holds every node");
+
+	const auto foundAppointment = index.Find(makeId("appointment", 0));
+	const auto foundTask = index.Find(makeId("task", 0));
+	const auto foundFolder = index.Find(makeId("folder", 0));
+
+	check(foundAppointment && foundAppointment->type == NodeIndex::NodeType::Appointment
+			&& foundAppointment->node == appointment,
+		"appointment is found with its type");
+	check(foundTask && foundTask->type == NodeIndex::NodeType::Task && foundTask->node == task,
+		"task is found with its type");
+	check(foundFolder && foundFolder->type == NodeIndex::NodeType::Folder
+			&& foundFolder->node == folder,
+		"a node inserted with a base64 id is found by its bytes");
+
+	const auto opaqueTask = index.Find(makeOpaqueId("dGFzazA="));
+
+	check(opaqueTask && opaqueTask->node == task, "a base64 id finds the node with those bytes");
+	check(!index.Find(makeId("task", 1)), "a missing id isn't found");
+	check(!index.Find(makeOpaqueId("dGFzazE=")), "a base64 id for missing bytes isn't found");
+	check(!index.Find(makeOpaqueId("task0")), "the text of an id isn't the same as its bytes");
+	check(!index.Find(makeOpaqueId("dGFz#zA=")), "an id with invalid base64 isn't found");
+	check(!index.Find(response::IdType { response::IdType::ByteData {} }),
+		"an empty id isn't found");
+
+	const auto replacement = makeTaskNode(makeId("task", 0));
+
+	index.Insert(makeOpaqueId("dGFzazA="), NodeIndex::NodeType::Task, replacement);
+
+	const auto replaced = index.Find(makeId("task", 0));
+
+	check(index.size() == 3, "inserting an existing id doesn't add an entry");
+	check(replaced && replaced->node == replacement, "inserting an existing id replaces it");
+}
+
+// Readers keep probing while the writer inserts one node at a time, so every Find races with an
+// Insert which copies the table, rehashes it into a larger one and publishes it. Every id which was
+// inserted before a reader started looking for it has to be found with the right node, and the
+// retired tables can only be reclaimed once the readers are joined, like ServiceInstance::Stop.
+void testConcurrentFind()
+{
+	constexpr int nodeCount = 2'000;
+	constexpr int readerCount = 4;
+	NodeIndex index;
+	std::vector<response::IdType> ids;
+	std::vector<std::shared_ptr<today::object::Node>> nodes;
+	std::atomic<int> inserted { 0 };
+	std::atomic<bool> done { false };
+	std::atomic<int> misses { 0 };
+	std::atomic<int> falseHits { 0 };
+	std::vector<std::thread> readers;
+
+	ids.reserve(nodeCount);
+	nodes.reserve(nodeCount);
+
+	for (int i = 0; i < nodeCount; ++i)
+	{
+		ids.push_back(makeId("task", i));
+		nodes.push_back(makeTaskNode(ids.back()));
+	}
+
+	const auto missingId = makeId("missing", 0);
+
+	for (int reader = 0; reader < readerCount; ++reader)
+	{
+		readers.emplace_back([&, reader]() {
+			for (int i = reader; !done.load(std::memory_order_acquire); ++i)
+			{
+				const auto count = inserted.load(std::memory_order_acquire);
+
+				if (count == 0)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+
+				const auto position = i % count;
+				const auto entry = index.Find(ids[position]);
+
+				if (!entry || entry->type != NodeIndex::NodeType::Task
+					|| entry->node != nodes[position])
+				{
+					misses.fetch_add(1, std::memory_order_relaxed);
+				}
+
+				if (index.Find(missingId))
+				{
+					falseHits.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+		});
+	}
+
+	for (int i = 0; i < nodeCount; ++i)
+	{
+		index.Insert(response::IdType { ids[i] }, NodeIndex::NodeType::Task, nodes[i]);
+		inserted.store(i + 1, std::memory_order_release);
+	}
+
+	done.store(true, std::memory_order_release);
+
+	for (auto& thread : readers)
+	{
+		thread.join();
+	}
+
+	check(misses.load() == 0, "readers find every inserted node while the table is rehashed");
+	check(falseHits.load() == 0, "readers never find a missing id");
+
+	index.Reclaim();
+
+	bool allFound = true;
+
+	for (int i = 0; i < nodeCount; ++i)
+	{
+		const auto entry = index.Find(ids[i]);
+
+		allFound = allFound && entry && entry->node == nodes[i];
+	}
+
+	check(index.size() == nodeCount, "index holds every node after Reclaim");
+	check(allFound, "every node is still found after Reclaim");
+	check(!index.Find(missingId), "a missing id isn't found after Reclaim");
+}
+
+} // namespace
+
+int main()
+{
+	testLookups();
+	testConcurrentFind();
+
+	return failures == 0 ? 0 : 1;
+}